@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <ncurses.h>
+#include <sys/syscall.h>
+
+#include "../src/structs.h"
+#include "../src/ncstructs.h"
+#include "../src/pieces.h"
+#include "../src/engine.h"
+#include "../src/logic.h"
+#include "../src/render.h"
+#include "../src/clock.h"
+
+// Replays a fixed sequence of game states through the renderer, on a terminal
+// of its own: a pseudo-terminal read by nothing but this program, or
+// /dev/null with -n. Every frame is drawn on this thread, the way the render
+// thread draws it. The system calls counted are the writes to the terminal,
+// where drawing goes out: write is replaced to count them.
+
+#define OPTIONS "nf:p:"
+#define USAGE "usage: %s [-n] [-f frames] [-p pieces_folder]\n"
+#define DEFAULT_FRAMES 2000
+#define DEFAULT_PIECES "pieces"
+#define TERMINAL "xterm-256color"	// the same escape codes on every host
+#define SEED 1
+#define START_LINES 40
+#define START_COLS 100
+#define RESIZED_LINES 50
+#define RESIZED_COLS 120
+
+typedef struct {
+	long long time;
+	long writes, bytes;
+	int frames;
+} Measure;
+
+static int counted_fd = -1;
+static long writes = 0, bytes = 0;
+static uint32_t rng = SEED;
+
+// Count the writes to the terminal. ncurses calls this instead of the write
+// of libc.
+ssize_t write(int fd, const void *buffer, size_t size) {
+	ssize_t written = syscall(SYS_write, fd, buffer, size);
+
+	if (fd == counted_fd) {
+		writes++;
+		if (written > 0) {
+			bytes += written;
+		}
+	}
+
+	return written;
+}
+
+static void start_measure(Measure *measure) {
+	measure->time -= time_ns();
+	measure->writes -= writes;
+	measure->bytes -= bytes;
+}
+
+static void stop_measure(Measure *measure) {
+	measure->time += time_ns();
+	measure->writes += writes;
+	measure->bytes += bytes;
+	measure->frames++;
+}
+
+static void print_measure(const char *name, const Measure *measure) {
+	int frames = (measure->frames > 0) ? measure->frames : 1;
+
+	printf("%-12s %8d %10.1f %14.2f %13.1f\n", name, measure->frames,
+		measure->time / 1000.0 / frames, (double)measure->writes / frames,
+		(double)measure->bytes / frames);
+}
+
+// xorshift, like the piece generator of the engine
+static uint32_t next_random() {
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+// Play with random moves, and take a frame after every move that changed
+// something. Each piece may be held, is rotated and shifted, then soft
+// dropped row by row and hard dropped. A game that is lost starts over.
+static void play(Frame *frames, int n) {
+	Game game;
+	int i = 0;
+
+	create_game(&game, SEED, BOARD_H);
+	while (i < n) {
+		int rotations = next_random() % MAX_ORIENTATIONS;
+		int shift = (int)(next_random() % BOARD_W) - BOARD_W / 2;
+		int events;
+
+		if (next_random() % 8 == 0 && game_hold(&game) && i < n) {
+			take_snapshot(&game, &frames[i++]);
+		}
+
+		for (int j = 0; j < rotations && i < n; j++) {
+			if (game_rotate(&game)) {
+				take_snapshot(&game, &frames[i++]);
+			}
+		}
+
+		while (shift != 0 && i < n &&
+			game_shift(&game, (shift > 0) ? 1 : -1, 1)) {
+			take_snapshot(&game, &frames[i++]);
+			shift += (shift > 0) ? -1 : 1;
+		}
+
+		while (i < n && game_soft_drop(&game)) {
+			take_snapshot(&game, &frames[i++]);
+		}
+
+		events = game_hard_drop(&game);
+		if (i < n) {
+			take_snapshot(&game, &frames[i++]);
+		}
+
+		if (events & GAME_OVER) {
+			free_game(&game);
+			create_game(&game, next_random(), BOARD_H);
+		}
+	}
+
+	free_game(&game);
+}
+
+// Take the frames before and after a line clear: the first piece of a game 
+// is put where it would land on an empty board, on rows that are full but 
+// for its cells, and dropped. Every row it covers is cleared. Returns the 
+// number of lines cleared.
+static int clear_lines(uint32_t seed, Frame *before, Frame *after) {
+	uint16_t landed[BOARD_H], board[BOARD_H];
+	MovingPiece mp;
+	Game game;
+	int lines;
+
+	create_game(&game, seed, BOARD_H);
+	mp = game.mp;
+	mp.position = mp.projection;
+	game_hard_drop(&game);
+	get_board(game.list, landed);
+	free_game(&game);
+
+	for (int y = 0; y < BOARD_H; y++) {
+		board[y] = landed[y] ? (FULL_ROW & ~landed[y]) : 0;
+	}
+
+	// The piece can't fall into those rows: it is put there
+	create_game(&game, seed, BOARD_H);
+	game_set_board(&game, board);
+	game_set_piece(&game, pack_piece(&mp));
+	take_snapshot(&game, before);
+	game_hard_drop(&game);
+	take_snapshot(&game, after);
+	lines = game.lines_cleared;
+	free_game(&game);
+
+	return lines;
+}
+
+// Drain the pseudo-terminal, like a terminal emulator that never falls behind.
+static void *drain(void *data) {
+	int master = *(int *)data;
+	char buffer[4096];
+
+	while (read(master, buffer, sizeof(buffer)) > 0) {
+	}
+
+	return NULL;
+}
+
+// Open the terminal to draw on. Returns its file descriptor, or -1. master is
+// the other end of the pseudo-terminal, -1 for /dev/null.
+static int open_terminal(int null, int *master) {
+	int fd;
+
+	*master = -1;
+	if (null) {
+		return open("/dev/null", O_RDWR);
+	}
+
+	*master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (*master == -1 || grantpt(*master) != 0 || unlockpt(*master) != 0 ||
+		(fd = open(ptsname(*master), O_RDWR | O_NOCTTY)) == -1) {
+		if (*master != -1) {
+			close(*master);
+		}
+		return -1;
+	}
+
+	return fd;
+}
+
+int main(int argc, char **argv) {
+	char *pieces_folder = DEFAULT_PIECES;
+	int n_frames = DEFAULT_FRAMES, null = 0, n_clears, n_resizes;
+	int fd, master, option;
+	char size[16];
+	Measure full = {0}, steady = {0}, clears = {0}, resizes = {0};
+	Frame *frames, *cleared;
+	GameWindows gw;
+	SCREEN *screen;
+	FILE *terminal;
+	pthread_t drainer;
+
+	while ((option = getopt(argc, argv, OPTIONS)) != -1) {
+		switch (option) {
+			case 'n':
+				null = 1;
+				break;
+			case 'f':
+				n_frames = atoi(optarg);
+				break;
+			case 'p':
+				pieces_folder = optarg;
+				break;
+			default:
+				fprintf(stderr, USAGE, argv[0]);
+				return 1;
+		}
+	}
+
+	if (n_frames < 2) {
+		fprintf(stderr, "at least 2 frames are needed\n");
+		return 1;
+	}
+
+	if (!set_pieces(pieces_folder)) {
+		fprintf(stderr, "could not load the pieces from %s\n", pieces_folder);
+		return 1;
+	}
+
+	// The states are made before drawing anything, so only drawing is timed
+	n_clears = n_frames / 10 + 1;
+	n_resizes = n_frames / 10 + 1;
+	frames = malloc(sizeof(Frame) * n_frames);
+	cleared = malloc(sizeof(Frame) * 2 * n_clears);
+	if (frames == NULL || cleared == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	play(frames, n_frames);
+	for (int i = 0; i < n_clears; i++) {
+		if (clear_lines(SEED + i, &cleared[2 * i], &cleared[2 * i + 1]) == 0) {
+			fprintf(stderr, "no line cleared with seed %d\n", SEED + i);
+			return 1;
+		}
+	}
+
+	fd = open_terminal(null, &master);
+	if (fd == -1 || (terminal = fdopen(fd, "r+")) == NULL) {
+		fprintf(stderr, "could not open a terminal\n");
+		return 1;
+	}
+
+	if (master != -1) {
+		pthread_create(&drainer, NULL, drain, &master);
+	}
+
+	// The size of a pseudo-terminal is 0x0 until it is set, and /dev/null
+	// has none
+	snprintf(size, sizeof(size), "%d", START_LINES);
+	setenv("LINES", size, 1);
+	snprintf(size, sizeof(size), "%d", START_COLS);
+	setenv("COLUMNS", size, 1);
+	screen = newterm(TERMINAL, terminal, terminal);
+	if (screen == NULL) {
+		fprintf(stderr, "could not start ncurses on %s\n", TERMINAL);
+		return 1;
+	}
+
+	counted_fd = fd;
+	setup_screen(&gw);
+	set_game_wins(&gw);
+	draw(gw, &frames[0]);
+
+	for (int i = 1; i < n_frames; i++) {
+		start_measure(&full);
+		draw(gw, &frames[i]);
+		stop_measure(&full);
+	}
+
+	for (int i = 1; i < n_frames; i++) {
+		start_measure(&steady);
+		draw_changes(gw, &frames[i], &frames[i - 1]);
+		stop_measure(&steady);
+	}
+
+	for (int i = 0; i < n_clears; i++) {
+		const Frame *shown = (i > 0) ? &cleared[2 * i - 1] :
+			&frames[n_frames - 1];
+		draw_changes(gw, &cleared[2 * i], shown);
+
+		start_measure(&clears);
+		draw_changes(gw, &cleared[2 * i + 1], &cleared[2 * i]);
+		stop_measure(&clears);
+	}
+
+	for (int i = 0; i < n_resizes; i++) {
+		start_measure(&resizes);
+		if (i % 2 == 0) {
+			resizeterm(RESIZED_LINES, RESIZED_COLS);
+		} else {
+			resizeterm(START_LINES, START_COLS);
+		}
+		resize_game(&gw, &frames[i % n_frames]);
+		stop_measure(&resizes);
+	}
+
+	draw_end(gw);
+	delscreen(screen);
+	counted_fd = -1;
+	fclose(terminal);
+	if (master != -1) {
+		// The drainer stops once the terminal is closed
+		pthread_join(drainer, NULL);
+		close(master);
+	}
+
+	printf("%s on %s, %dx%d\n", TERMINAL, null ? "/dev/null" : "a pty",
+		START_COLS, START_LINES);
+	printf("%-12s %8s %10s %14s %13s\n", "scenario", "frames", "us/frame",
+		"writes/frame", "bytes/frame");
+	print_measure("full redraw", &full);
+	print_measure("steady play", &steady);
+	print_measure("line clear", &clears);
+	print_measure("resize", &resizes);
+
+	free(frames);
+	free(cleared);
+	return 0;
+}
@@ -1,12 +1,278 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
 
+#include "src/structs.h"
 #include "src/logic.h"
+#include "src/pieces.h"
+#include "src/stats.h"
+#include "src/export.h"
+#include "src/engine.h"
+#include "src/solver.h"
+#include "src/scores.h"
+#include "src/placements.h"
+#include "src/trace.h"
+#include "src/clock.h"
+
+#define DEFAULT_DAS 167
+#define DEFAULT_ARR 33
+#define DEFAULT_PIECES "pieces"
+
+extern char PIECE_NAMES[MAX_PIECES][MAX_PIECE_NAME + 1];
+
+#ifdef TRACE
+#define OPTIONS "d:a:s:p:e:r:H:D:lA:P:S:Tc:b:g:w:t:"
+#define USAGE "usage: %s [-d das_ms] [-a arr_ms] [-s stats_file] " \
+	"[-p pieces_folder] [-e export_file] [-r seed] [-H rows] [-D rows] " \
+	"[-l] [-A think_ms] [-P placement_file] [-S score_file] " \
+	"[-t trace_file]\n" \
+	"       %s -c queue [-b board_file] [-g goal_file] [-r seed] " \
+	"[-p pieces_folder]\n" \
+	"       %s -T -S score_file\n" \
+	"       %s -w placement_file [-p pieces_folder]\n"
+#else
+#define OPTIONS "d:a:s:p:e:r:H:D:lA:P:S:Tc:b:g:w:"
+#define USAGE "usage: %s [-d das_ms] [-a arr_ms] [-s stats_file] " \
+	"[-p pieces_folder] [-e export_file] [-r seed] [-H rows] [-D rows] " \
+	"[-l] [-A think_ms] [-P placement_file] [-S score_file]\n" \
+	"       %s -c queue [-b board_file] [-g goal_file] [-r seed] " \
+	"[-p pieces_folder]\n" \
+	"       %s -T -S score_file\n" \
+	"       %s -w placement_file [-p pieces_folder]\n"
+#endif
+
+// Solve a perfect clear (or build the goal shape) with a queue of pieces and 
+// print the moves. The queue is either piece names, or a number of pieces to 
+// take from the game with the seed. Returns the exit status.
+static int practice(char *queue_text, char *board_file, char *goal_file, 
+					uint32_t seed) {
+	uint16_t board[BOARD_H] = {0}, goal[BOARD_H];
+	int queue[MAX_QUEUE], n_queue, found;
+	Solution solution;
+	long long started, elapsed;
+
+	if (strspn(queue_text, "0123456789") == strlen(queue_text)) {
+		n_queue = atoi(queue_text);
+		if (n_queue < 1 || n_queue > MAX_QUEUE) {
+			fprintf(stderr, "the queue has 1 to %d pieces\n", MAX_QUEUE);
+			return 1;
+		}
+		game_pieces(seed, n_queue, queue);
+		printf("seed %u:", seed);
+		for (int i = 0; i < n_queue; i++) {
+			printf(" %s", PIECE_NAMES[queue[i]]);
+		}
+		printf("\n");
+	} else if ((n_queue = parse_queue(queue_text, queue, MAX_QUEUE)) < 1) {
+		fprintf(stderr, "could not read the queue %s\n", queue_text);
+		return 1;
+	}
+
+	if (board_file != NULL && read_board(board_file, board) != 0) {
+		fprintf(stderr, "could not read the board from %s\n", board_file);
+		return 1;
+	}
+
+	if (goal_file != NULL && read_board(goal_file, goal) != 0) {
+		fprintf(stderr, "could not read the goal from %s\n", goal_file);
+		return 1;
+	}
+
+	started = time_ns();
+	found = solve(board, goal_file ? goal : NULL, queue, n_queue, 1, 
+		&solution);
+	elapsed = time_ns() - started;
+
+	if (found == SOLVE_TOO_TALL) {
+		fprintf(stderr, "the board and goal must fit in %d rows\n", 
+			SOLVER_MAX_HEIGHT);
+		return 1;
+	} else if (found == SOLVE_NO_MEMORY) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	} else if (found == SOLVE_DISAGREED) {
+		fprintf(stderr, "the game did not play the solution as found\n");
+		return 1;
+	}
+
+	if (found == 1) {
+		print_solution(&solution);
+	}
+	printf("%s (%.3f s)\n", (found == 1) ? (goal_file ? "goal reached" : 
+		"perfect clear") : (found == SOLVE_GAVE_UP) ? 
+		"no solution found, gave up" : "no solution", elapsed / 1e9);
+	return (found == 1) ? 0 : 2;
+}
+
+int main(int argc, char *argv[]) {
+	Settings settings;
+	Stats stats;
+	char *export_file = NULL, *queue = NULL, *board_file = NULL;
+	char *goal_file = NULL, *score_file = NULL, *placement_file = NULL;
+	char *table_file = NULL;
+	ScoreFile *scores = NULL;
+	ScoreRecord record;
+	int level, opt, show_scores = 0, rank;
+	settings.das = DEFAULT_DAS;
+	settings.arr = DEFAULT_ARR;
+	settings.stats_file = NULL;
+	settings.pieces_folder = DEFAULT_PIECES;
+	settings.exporter = NULL;
+	settings.placements = NULL;
+	settings.seed = time(NULL);
+	settings.rows = BOARD_H;
+	settings.dig = 0;
+	settings.pacing = 0;
+	settings.autoplay = 0;
+
+	while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+		switch (opt) {
+			case 'd':
+				settings.das = atoi(optarg);
+				break;
+			case 'a':
+				settings.arr = atoi(optarg);
+				break;
+			case 's':
+				settings.stats_file = optarg;
+				break;
+			case 'e':
+				export_file = optarg;
+				break;
+			case 'p':
+				settings.pieces_folder = optarg;
+				break;
+			case 'r':
+				settings.seed = strtoul(optarg, NULL, 10);
+				break;
+			case 'H':
+				settings.rows = atoi(optarg);
+				break;
+			case 'D':
+				settings.dig = atoi(optarg);
+				break;
+			case 'l':
+				settings.pacing = 1;
+				break;
+			case 'A':
+				settings.autoplay = atoi(optarg);
+				break;
+			case 'P':
+				placement_file = optarg;
+				break;
+			case 'S':
+				score_file = optarg;
+				break;
+			case 'T':
+				show_scores = 1;
+				break;
+			case 'c':
+				queue = optarg;
+				break;
+			case 'b':
+				board_file = optarg;
+				break;
+			case 'g':
+				goal_file = optarg;
+				break;
+			case 'w':
+				table_file = optarg;
+				break;
+			case 't':
+				trace_start(optarg);
+				break;
+			default:
+				fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0]);
+				return 1;
+		}
+	}
+
+	if (settings.das < 0 || settings.arr < 0 || settings.rows < BOARD_H || 
+		settings.rows > MAX_BOARD_ROWS || settings.dig < 0 || 
+		settings.dig > settings.rows - BOARD_H || settings.autoplay < 0 || 
+		(show_scores && score_file == NULL)) {
+		fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0]);
+		return 1;
+	}
+
+	// Opened before the game, so the game isn't played for nothing
+	if (score_file != NULL && (scores = open_scores(score_file)) == NULL) {
+		fprintf(stderr, "could not open the scores in %s\n", score_file);
+		return 1;
+	}
+
+	if (show_scores) {
+		print_scores(scores);
+		close_scores(scores);
+		return 0;
+	}
+
+	if (!set_pieces(settings.pieces_folder)) {
+		fprintf(stderr, "could not load pieces from %s\n", 
+			settings.pieces_folder);
+		return 1;
+	}
+
+	if (queue != NULL) {
+		return practice(queue, board_file, goal_file, settings.seed);
+	}
+
+	if (table_file != NULL) {
+		if (write_placements(table_file) != 0) {
+			fprintf(stderr, "could not write the placements to %s\n", 
+				table_file);
+			return 1;
+		}
+		return 0;
+	}
+
+	if (placement_file != NULL && 
+		(settings.placements = open_placements(placement_file)) == NULL) {
+		fprintf(stderr, "could not use the placements in %s (make them "
+			"with -w, for the same pieces)\n", placement_file);
+		return 1;
+	}
+
+	if (export_file != NULL && 
+		(settings.exporter = open_exporter(export_file)) == NULL) {
+		fprintf(stderr, "could not export placements to %s\n", export_file);
+		return 1;
+	}
+
+	int score = begin(settings, &stats, &level);
+	trace_dump();
+	if (settings.placements != NULL) {
+		close_placements(settings.placements);
+	}
 
-int main() {
-	int level;
-	int score = begin(&level);
 	printf("thanks for playing!\n");
 	printf("your level: %d\n", level);
 	printf("your score: %d\n", score);
+
+	if (settings.exporter != NULL && close_exporter(settings.exporter) != 0) {
+		fprintf(stderr, "could not export placements to %s\n", export_file);
+	}
+
+	if (settings.stats_file != NULL && 
+		append_stats(settings.stats_file, &stats) != 0) {
+		fprintf(stderr, "could not save statistics to %s\n", 
+			settings.stats_file);
+	}
+
+	if (scores != NULL) {
+		create_score(&record, &stats);
+		rank = add_score(scores, &record);
+		if (rank == -1) {
+			fprintf(stderr, "could not save the score: %s is full\n", 
+				score_file);
+		} else if (rank > 0) {
+			printf("new high score: #%d\n", rank);
+		}
+
+		print_scores(scores);
+		close_scores(scores);
+	}
 	return 0;
 }
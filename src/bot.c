@@ -0,0 +1,566 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "structs.h"
+#include "engine.h"
+#include "table.h"
+#include "placements.h"
+#include "clock.h"
+#include "trace.h"
+
+// The bot thinks on its own thread, so the game keeps ticking (and the piece
+// keeps falling) while it does. The game asks it for a move whenever a piece
+// spawns, with the board, the pieces it knows about (the current piece, the
+// next one and the held one) and a deadline, and checks for the answer every
+// tick. A question the game no longer waits for (its piece was placed) is
+// dropped, even in the middle of a search.
+//
+// The search is a beam search. Each level places one of the known pieces, the
+// held piece included, in every orientation and column it can be hard dropped
+// in, and only keeps the best boards for the next level. Past the preview, a
+// board is worth the average, over every piece type, of the best board that
+// piece could make. With a placement table, that estimate only tries the
+// orientations and columns where a piece rests flat on the stack, when there
+// are any: most of the search is spent there. The moves searched are never
+// narrowed down this way, as the best move often leaves a hole (an I dropped
+// upright always rests flat). The first search has a narrow beam, then the beam
+// is widened until the deadline: the answer is the best move of the last search
+// that finished.
+
+#define MAX_DEPTH 2		// pieces known: the current piece and the next one
+#define FIRST_WIDTH 4	// the first search always finishes, even if late
+#define MAX_WIDTH 256
+#define WIDTH_GROWTH 4
+#define MAX_CHILDREN (2 * MAX_ORIENTATIONS * BOARD_W)
+#define SEEN_BITS 16
+#define LOST -1e9
+
+// Weights of the features of a board, found by a genetic search (from Yiyuan
+// Lee's "Tetris AI -- The (Near) Perfect Bot")
+#define HEIGHT_WEIGHT -0.510066
+#define LINES_WEIGHT 0.760666
+#define HOLES_WEIGHT -0.35663
+#define BUMPINESS_WEIGHT -0.184483
+
+extern Piece ORIENTATIONS[MAX_PIECES][MAX_ORIENTATIONS];
+extern int N_ORIENTATIONS[MAX_PIECES];
+extern int N_PIECES;
+
+// A question from the game. queue has the current and next pieces. The
+// board has row 0 at the top, as in get_board.
+typedef struct {
+	uint16_t board[BOARD_H];
+	int queue[MAX_DEPTH], held, can_hold;
+	long long deadline;
+	unsigned id;
+} BotProblem;
+
+// A board made by dropping an orientation with its grid at column x.
+typedef struct {
+	uint16_t board[BOARD_H];
+	int rotation, x, lines;
+} Drop;
+
+// The height of each column of a board, and its contour keys (only with a 
+// placement table).
+typedef struct {
+	int heights[BOARD_W];
+	uint32_t keys[BOARD_W];
+} Surface;
+
+// A board reached by the search: index is the first piece of the queue not
+// played yet. score counts the lines cleared on the way there, value adds the
+// evaluation of the board. first is the move that started it all.
+typedef struct {
+	uint16_t board[BOARD_H];
+	int index, held;
+	double score, value;
+	BotMove first;
+} BotNode;
+
+// asked is the id of the last question, answered the id of the question move
+// answers (0 once the game took it).
+struct bot {
+	BotProblem problem;
+	BotMove move;
+	unsigned asked, answered;
+	int stopping;
+	uint32_t generation;
+	BotNode *beam, *children;
+	TransTable *seen;
+	const PlacementTable *placements;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t thread;
+};
+
+// Check whether a search must stop: it is too late, or the game asked
+// something else.
+static int cut_short(Bot *bot, const BotProblem *problem) {
+	return time_ns() >= problem->deadline ||
+		__atomic_load_n(&bot->asked, __ATOMIC_RELAXED) != problem->id;
+}
+
+static uint16_t row_mask(const Piece *piece, int row, int x) {
+	return (x >= 0) ? piece->masks[row] << x : piece->masks[row] >> -x;
+}
+
+// Check whether an orientation fits with its grid at column x, row y.
+static int fits(const uint16_t board[BOARD_H], const Piece *piece, int x,
+				int y) {
+	for (int row = piece->top; row <= piece->bottom; row++) {
+		if (y + row >= BOARD_H) {
+			return 0;
+		}
+		if (y + row >= 0 && (board[y + row] & row_mask(piece, row, x))) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// Place an orientation with its grid at column x, row y, and clear the full 
+// rows. Returns the number of rows cleared.
+static int place(const uint16_t board[BOARD_H], const Piece *piece, int x,
+				 int y, uint16_t placed[BOARD_H]) {
+	int row = BOARD_H - 1;
+
+	memcpy(placed, board, sizeof(uint16_t) * BOARD_H);
+	for (int i = piece->top; i <= piece->bottom; i++) {
+		if (y + i >= 0) {
+			placed[y + i] |= row_mask(piece, i, x);
+		}
+	}
+
+	// Move the rows that aren't full down over the ones that are
+	for (int from = BOARD_H - 1; from >= 0; from--) {
+		if (placed[from] != (1 << BOARD_W) - 1) {
+			placed[row--] = placed[from];
+		}
+	}
+
+	for (int i = row; i >= 0; i--) {
+		placed[i] = 0;
+	}
+
+	return row + 1;
+}
+
+// Hard drop an orientation at column x from the top of the board. Returns the 
+// number of rows cleared, or -1 if the piece doesn't fit at the top.
+static int drop(const uint16_t board[BOARD_H], const Piece *piece, int x,
+				uint16_t placed[BOARD_H]) {
+	int y = -piece->top;
+
+	if (!fits(board, piece, x, y)) {
+		return -1;
+	}
+
+	while (fits(board, piece, x, y + 1)) {
+		y++;
+	}
+
+	return place(board, piece, x, y, placed);
+}
+
+// Get the height of each column: the rows from the bottom to its top block.
+static void get_heights(const uint16_t board[BOARD_H], int heights[BOARD_W]) {
+	uint16_t covered = 0;
+
+	memset(heights, 0, sizeof(int) * BOARD_W);
+	for (int y = 0; y < BOARD_H; y++) {
+		uint16_t tops = board[y] & ~covered;
+		while (tops != 0) {
+			heights[__builtin_ctz(tops)] = BOARD_H - y;
+			tops &= tops - 1;
+		}
+		covered |= board[y];
+	}
+}
+
+// Rate a board by the height of its columns, the holes under them, and how
+// much the heights of neighbouring columns differ.
+static double evaluate(const uint16_t board[BOARD_H]) {
+	int heights[BOARD_W];
+	int aggregate = 0, holes = 0, bumpiness = 0;
+	uint16_t covered = 0;
+
+	get_heights(board, heights);
+	for (int y = 0; y < BOARD_H; y++) {
+		holes += __builtin_popcount(covered & ~board[y]);
+		covered |= board[y];
+	}
+
+	for (int x = 0; x < BOARD_W; x++) {
+		aggregate += heights[x];
+		if (x > 0) {
+			bumpiness += abs(heights[x] - heights[x - 1]);
+		}
+	}
+
+	return HEIGHT_WEIGHT * aggregate + HOLES_WEIGHT * holes +
+		BUMPINESS_WEIGHT * bumpiness;
+}
+
+static uint64_t hash_board(const uint16_t board[BOARD_H]) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (int y = 0; y < BOARD_H; y++) {
+		hash = (hash ^ board[y]) * 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+static void get_surface(const Bot *bot, const uint16_t board[BOARD_H], 
+						Surface *surface) {
+	if (bot->placements != NULL) {
+		get_heights(board, surface->heights);
+		surface_keys(bot->placements, surface->heights, surface->keys);
+	}
+}
+
+// Find the boards a piece type makes on a board: the placements where it 
+// rests flat, looked up from the surface of the board, or if there are none 
+// (or no surface is given), every orientation in every column. Returns the 
+// number of drops.
+static int get_drops(const Bot *bot, const uint16_t board[BOARD_H],
+					 const Surface *surface, int type, Drop *drops) {
+	int n = 0;
+
+	if (bot->placements != NULL && surface != NULL) {
+		for (int column = 0; column < BOARD_W; column++) {
+			int resting = resting_orientations(bot->placements, type, 
+				surface->keys[column]);
+			while (resting != 0) {
+				int o = __builtin_ctz(resting), y;
+				Piece *piece = &ORIENTATIONS[type][o];
+
+				resting &= resting - 1;
+				// The lowest block of the first column lands on the stack
+				y = piece->bottom;
+				while (!((piece->masks[y] >> piece->left) & 1)) {
+					y--;
+				}
+				y = BOARD_H - 1 - surface->heights[column] - y;
+				if (y + piece->top < 0) {
+					continue;
+				}
+
+				drops[n].rotation = o;
+				drops[n].x = column - piece->left;
+				drops[n].lines = place(board, piece, drops[n].x, y, 
+					drops[n].board);
+				n++;
+			}
+		}
+
+		if (n > 0) {
+			return n;
+		}
+	}
+
+	for (int o = 0; o < N_ORIENTATIONS[type]; o++) {
+		Piece *piece = &ORIENTATIONS[type][o];
+		for (int x = -piece->left; x + piece->right < BOARD_W; x++) {
+			drops[n].lines = drop(board, piece, x, drops[n].board);
+			if (drops[n].lines != -1) {
+				drops[n].rotation = o;
+				drops[n].x = x;
+				n++;
+			}
+		}
+	}
+
+	return n;
+}
+
+// Add the boards a piece makes from a node as children, skipping the boards
+// already reached at this level in a better way. Returns the new number of
+// children.
+static int expand(Bot *bot, const BotNode *node, int depth, int type,
+				  int index, int held, int hold, BotNode *children, int n) {
+	Drop drops[MAX_ORIENTATIONS * BOARD_W];
+	uint32_t state = (held + 1) | index << 6 | bot->generation << 8;
+	int n_drops = get_drops(bot, node->board, NULL, type, drops);
+
+	for (int i = 0; i < n_drops; i++) {
+		BotNode *child = &children[n];
+		uint64_t hash;
+		int slot;
+
+		memcpy(child->board, drops[i].board, sizeof(child->board));
+		child->index = index;
+		child->held = held;
+		child->score = node->score + LINES_WEIGHT * drops[i].lines;
+		child->value = child->score + evaluate(child->board);
+		if (depth == 0) {
+			BotMove first = {hold, type, drops[i].rotation, drops[i].x};
+			child->first = first;
+		} else {
+			child->first = node->first;
+		}
+
+		hash = hash_board(child->board);
+		if (table_get(bot->seen, hash, state, &slot)) {
+			if (child->value > children[slot].value) {
+				children[slot] = *child;
+			}
+			continue;
+		}
+
+		table_put(bot->seen, hash, state, n);
+		n++;
+	}
+
+	return n;
+}
+
+static int by_value(const void *a, const void *b) {
+	double difference = ((const BotNode *)b)->value -
+		((const BotNode *)a)->value;
+	return (difference > 0) - (difference < 0);
+}
+
+// Value a board at the end of the preview: the average over every piece type
+// of the best board it can make.
+static double lookahead(const Bot *bot, const BotNode *node) {
+	Drop drops[MAX_ORIENTATIONS * BOARD_W];
+	Surface surface;
+	double total = 0;
+
+	get_surface(bot, node->board, &surface);
+	for (int type = 0; type < N_PIECES; type++) {
+		int n_drops = get_drops(bot, node->board, &surface, type, drops);
+		double best = LOST;
+		for (int i = 0; i < n_drops; i++) {
+			double value = LINES_WEIGHT * drops[i].lines + 
+				evaluate(drops[i].board);
+			if (value > best) {
+				best = value;
+			}
+		}
+		total += best;
+	}
+
+	return node->score + total / N_PIECES;
+}
+
+// Search with beams of a certain width. Returns 1 and saves the best move,
+// 0 if there is none or the search was cut short (only checked if check is
+// set). full is set if the beam never had to drop a board.
+static int beam_search(Bot *bot, const BotProblem *problem, int width,
+					   int check, BotMove *move, int *full) {
+	BotNode *beam = bot->beam, *children = bot->children;
+	int n_beam = 1, n_children, best = -1;
+	double best_value = LOST;
+
+	memcpy(beam[0].board, problem->board, sizeof(beam[0].board));
+	beam[0].index = 0;
+	beam[0].held = problem->held;
+	beam[0].score = 0;
+	*full = 1;
+
+	for (int depth = 0; depth < MAX_DEPTH; depth++) {
+		if (++bot->generation == 1 << 24) {
+			bot->generation = 1;
+		}
+
+		n_children = 0;
+		for (int i = 0; i < n_beam; i++) {
+			BotNode *node = &beam[i];
+			int index = node->index, held = node->held;
+			int type = problem->queue[index];
+
+			if (check && cut_short(bot, problem)) {
+				return 0;
+			}
+
+			if (index == MAX_DEPTH) {
+				// Both pieces were played (the first one went to hold)
+				children[n_children++] = *node;
+				continue;
+			}
+
+			n_children = expand(bot, node, depth, type, index + 1, held, 0,
+				children, n_children);
+
+			if (depth == 0 && !problem->can_hold) {
+				continue;
+			}
+
+			// Hold: swap with the held piece, or play the next piece
+			if (held == -1 && index + 1 < MAX_DEPTH) {
+				n_children = expand(bot, node, depth,
+					problem->queue[index + 1], index + 2, type, 1, children,
+					n_children);
+			} else if (held != -1 && held != type) {
+				n_children = expand(bot, node, depth, held, index + 1, type,
+					1, children, n_children);
+			}
+		}
+
+		if (n_children == 0) {
+			return 0;
+		}
+
+		qsort(children, n_children, sizeof(BotNode), by_value);
+		if (n_children > width) {
+			n_children = width;
+			*full = 0;
+		}
+
+		memcpy(beam, children, sizeof(BotNode) * n_children);
+		n_beam = n_children;
+	}
+
+	for (int i = 0; i < n_beam; i++) {
+		double value;
+		if (check && cut_short(bot, problem)) {
+			return 0;
+		}
+
+		value = lookahead(bot, &beam[i]);
+		if (best == -1 || value > best_value) {
+			best = i;
+			best_value = value;
+		}
+	}
+
+	*move = beam[best].first;
+	return 1;
+}
+
+// Search with wider and wider beams, until the deadline or until the beam
+// holds every board. Returns 0 if there is no move at all.
+static int think(Bot *bot, const BotProblem *problem, BotMove *move) {
+	TRACE_SCOPE(TRACE_BOT_SEARCH);
+	int full;
+
+	if (!beam_search(bot, problem, FIRST_WIDTH, 0, move, &full)) {
+		return 0;
+	}
+
+	for (int width = FIRST_WIDTH * WIDTH_GROWTH; !full && width <= MAX_WIDTH;
+		width *= WIDTH_GROWTH) {
+		BotMove better;
+		if (!beam_search(bot, problem, width, 1, &better, &full)) {
+			break;
+		}
+		*move = better;
+	}
+
+	return 1;
+}
+
+// Answer the questions of the game, until it stops the bot.
+static void *run_bot(void *data) {
+	Bot *bot = data;
+	BotProblem problem;
+	BotMove move;
+	unsigned last = 0;
+	int found;
+
+	pthread_mutex_lock(&bot->lock);
+	while (!bot->stopping) {
+		if (bot->asked == last) {
+			pthread_cond_wait(&bot->wake, &bot->lock);
+			continue;
+		}
+
+		problem = bot->problem;
+		last = problem.id;
+		pthread_mutex_unlock(&bot->lock);
+
+		found = think(bot, &problem, &move);
+
+		pthread_mutex_lock(&bot->lock);
+		if (found && bot->asked == problem.id) {
+			bot->move = move;
+			bot->answered = problem.id;
+		}
+	}
+	pthread_mutex_unlock(&bot->lock);
+
+	return NULL;
+}
+
+// Start the bot thread. placements is the placement table to look drops up 
+// in, or NULL. Returns NULL if the bot can't be started.
+Bot *start_bot(const PlacementTable *placements) {
+	Bot *bot = calloc(1, sizeof(Bot));
+
+	if (bot == NULL) {
+		return NULL;
+	}
+
+	bot->beam = malloc(sizeof(BotNode) * MAX_WIDTH);
+	bot->children = malloc(sizeof(BotNode) * MAX_WIDTH * MAX_CHILDREN);
+	bot->seen = create_table(SEEN_BITS);
+	if (bot->beam == NULL || bot->children == NULL || bot->seen == NULL) {
+		free(bot->beam);
+		free(bot->children);
+		if (bot->seen != NULL) {
+			free_table(bot->seen);
+		}
+		free(bot);
+		return NULL;
+	}
+
+	bot->placements = placements;
+	pthread_mutex_init(&bot->lock, NULL);
+	pthread_cond_init(&bot->wake, NULL);
+	pthread_create(&bot->thread, NULL, run_bot, bot);
+	return bot;
+}
+
+void stop_bot(Bot *bot) {
+	pthread_mutex_lock(&bot->lock);
+	bot->stopping = 1;
+	// A search in progress sees the question change, and stops
+	__atomic_store_n(&bot->asked, bot->asked + 1, __ATOMIC_RELAXED);
+	pthread_cond_signal(&bot->wake);
+	pthread_mutex_unlock(&bot->lock);
+	pthread_join(bot->thread, NULL);
+
+	pthread_cond_destroy(&bot->wake);
+	pthread_mutex_destroy(&bot->lock);
+	free_table(bot->seen);
+	free(bot->beam);
+	free(bot->children);
+	free(bot);
+}
+
+// Ask for a move for the piece that just spawned, to be found by deadline (on
+// the monotonic clock, in nanoseconds). The answer to the last question is
+// dropped if it wasn't taken.
+void ask_bot(Bot *bot, const Game *game, long long deadline) {
+	pthread_mutex_lock(&bot->lock);
+	get_board(game->list, bot->problem.board);
+	bot->problem.queue[0] = game->mp.type;
+	bot->problem.queue[1] = game->next_type;
+	bot->problem.held = game->held_type;
+	bot->problem.can_hold = !game->has_held;
+	bot->problem.deadline = deadline;
+	bot->problem.id = bot->asked + 1;
+	__atomic_store_n(&bot->asked, bot->problem.id, __ATOMIC_RELAXED);
+	bot->answered = 0;
+	pthread_cond_signal(&bot->wake);
+	pthread_mutex_unlock(&bot->lock);
+}
+
+// Take the answer to the last question, if it is ready. Returns 1 if it was.
+int take_move(Bot *bot, BotMove *move) {
+	int ready;
+
+	pthread_mutex_lock(&bot->lock);
+	ready = (bot->answered != 0 && bot->answered == bot->asked);
+	if (ready) {
+		*move = bot->move;
+		bot->answered = 0;
+	}
+	pthread_mutex_unlock(&bot->lock);
+
+	return ready;
+}
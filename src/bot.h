@@ -0,0 +1,4 @@
+Bot *start_bot(const PlacementTable *placements);
+void stop_bot(Bot *bot);
+void ask_bot(Bot *bot, const Game *game, long long deadline);
+int take_move(Bot *bot, BotMove *move);
\ No newline at end of file
@@ -0,0 +1,9 @@
+#include <time.h>
+
+// Time elapsed since an arbitrary point, in nanoseconds. Unaffected by changes 
+// to the system clock.
+long long time_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
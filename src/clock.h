@@ -0,0 +1 @@
+long long time_ns();
\ No newline at end of file
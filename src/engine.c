@@ -0,0 +1,738 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "structs.h"
+#include "lists.h"
+#include "trace.h"
+
+#define MAX_GRAVITY 20.0	// rows per tick (20G)
+#define LOCK_DELAY_TICKS 30	// 0.5 seconds
+#define MAX_LOCK_RESETS 15
+#define GARBAGE_COLOUR 4	// white, for rows not made of pieces
+#define VIEW_BELOW 8	// rows of the stack in the window of tall boards
+
+// Packed piece states (see pack_piece). x and y are stored with a bias: the 
+// grid of a piece can stick out of the board.
+#define STATE_BIAS MAX_PIECE_SIZE
+#define STATE_VALID (1U << 30)
+
+_Static_assert(MAX_PIECES <= 32 && MAX_ORIENTATIONS <= 4 && 
+	BOARD_W + 2 * STATE_BIAS <= 32 && 
+	MAX_BOARD_ROWS + 2 * STATE_BIAS <= 1 << 18,
+	"a piece state must fit in 30 bits");
+
+extern Piece PIECES[MAX_PIECES];
+extern Piece ORIENTATIONS[MAX_PIECES][MAX_ORIENTATIONS];
+extern int N_ORIENTATIONS[MAX_PIECES];
+extern int N_PIECES;
+
+// Guideline speed curve: seconds it takes the piece to fall one row on each 
+// level, (0.8 - (level - 1) * 0.007) ^ (level - 1).
+static const double SECONDS_PER_ROW[MAX_LEVEL] = {
+	1.00000, 0.79300, 0.61780, 0.47273, 0.35520, 
+	0.26200, 0.18968, 0.13473, 0.09388, 0.06415, 
+	0.04298, 0.02822, 0.01815, 0.01144, 0.00706, 
+	0.00426, 0.00252, 0.00146, 0.00082, 0.00046
+};
+
+// Gravity on a level, in (possibly fractional) rows per simulation tick.
+static float gravity_for_level(int level) {
+	double gravity = 1.0 / (SECONDS_PER_ROW[level - 1] * SIM_RATE);
+	if (gravity > MAX_GRAVITY) {
+		gravity = MAX_GRAVITY;
+	}
+
+	return gravity;
+}
+
+// Find what list index a y coordinate would translate to
+static int list_index_from_y(int y, List list) {
+	return list.height - 1 - y;
+}
+
+// splitmix64: a well mixed 64 bit value for each input
+static uint64_t mix(uint64_t z) {
+	z += 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// Boards are hashed with Zobrist hashing: each cell has a random key, and the 
+// hash of a board is the XOR of the keys of its blocks, so adding a block only 
+// takes an XOR. The key of a cell is mixed from its list index and column 
+// instead of being kept in a table, which would be huge for tall boards.
+static uint64_t cell_key(int index, int x) {
+	return mix((uint64_t)index * BOARD_W + x);
+}
+
+// Hash the blocks of the rows from an index to the top of the list.
+static uint64_t rows_key(List list, int from) {
+	uint64_t hash = 0;
+
+	for (int i = from; i < list.count; i++) {
+		unsigned mask = list.rows[i]->mask;
+		while (mask != 0) {
+			hash ^= cell_key(i, __builtin_ctz(mask));
+			mask &= mask - 1;
+		}
+	}
+
+	return hash;
+}
+
+// Count the rows of the stack, ignoring empty rows on top of it.
+int stack_height(List list) {
+	Node *node = list.end, *prev = NULL;
+	int height = list.count;
+
+	while (node != NULL) {
+		if (node->mask != 0) {
+			return height;
+		}
+
+		height--;
+		node = get_offset_node(node, prev, 1, &prev);
+	}
+
+	return 0;
+}
+
+// Boards taller than BOARD_H rows are played in a window of BOARD_H rows 
+// that reaches VIEW_BELOW rows into the stack. This returns the y of its top 
+// row, where pieces spawn. It is always 0 on boards of BOARD_H rows.
+static int window_top(List list) {
+	int top = list.height - stack_height(list) - (BOARD_H - VIEW_BELOW);
+
+	if (top > list.height - BOARD_H) {
+		top = list.height - BOARD_H;
+	}
+
+	return (top < 0) ? 0 : top;
+}
+
+// Find the y of the top row to show on screen: the top of the window, moved 
+// down if the piece went below it.
+int board_view(List list, const MovingPiece *mp) {
+	int top = window_top(list);
+	int bottom = mp->position.y + mp->structure.bottom;
+
+	if (bottom >= top + BOARD_H) {
+		top = bottom - BOARD_H + 1;
+	}
+
+	return top;
+}
+
+// This function checks if there would be a collision between a piece at 
+// (x, y) and the static blocks (saved in the XOR linked list) or the boundary.
+// Each row of the piece is checked at once, using the collision masks.
+static int collides_at(const Piece *piece, int x, int y, List list) {
+	TRACE_SCOPE(TRACE_CHECK_COLLISIONS);
+
+	if (x + piece->left < 0 || x + piece->right >= BOARD_W) {
+		// Collision with the left-right boundary
+		return 1;
+	}
+
+	for (int i = piece->top; i <= piece->bottom; i++) {
+		int mask = piece->masks[i];
+
+		int index = list_index_from_y(y + i, list);
+
+		if (index >= list.count) {
+			// This line does not exist in the list, no collision here.
+			continue;
+		}
+
+		// This line exists in the list (unless it is below the ground)
+		Node *line = (index >= 0) ? list.rows[index] : NULL;
+		if (line == NULL) {
+			// Collision with the ground
+			return 1;
+		}
+
+		// Move the mask to the column of the piece
+		if (x >= 0) {
+			mask <<= x;
+		} else {
+			mask >>= -x;
+		}
+
+		if (line->mask & mask) {
+			// Collision with a block
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Check the moving piece where it is.
+static int check_collisions(const MovingPiece *mp, List list) {
+	return collides_at(&mp->structure, mp->position.x, mp->position.y, list);
+}
+
+// Check whether the moving piece can go one row down.
+static int can_fall(const MovingPiece *mp, List list) {
+	return !collides_at(&mp->structure, mp->position.x, mp->position.y + 1, 
+		list);
+}
+
+static void move_down(MovingPiece *mp, List list) {
+	mp->current = get_oob_offset_node(mp->current, mp->next, 1, &mp->next, 
+		list_index_from_y(mp->position.y, list), list);
+	mp->position.y++;
+}
+
+// Forcefully make a piece fall (equivalent to spacebar on most implementations)
+static void fall(MovingPiece *mp, List list) {
+	while (can_fall(mp, list)) {
+		move_down(mp, list);
+	}
+}
+
+// Update the projection coordinates of a piece. A projection is a preview of 
+// the piece position if the user were to force fall. Only the position is 
+// looked for: the nodes of the piece don't need to follow.
+static void get_projection(MovingPiece *mp, List list) {
+	TRACE_SCOPE(TRACE_GET_PROJECTION);
+	int y = mp->position.y;
+
+	while (!collides_at(&mp->structure, mp->position.x, y + 1, list)) {
+		y++;
+	}
+
+	mp->projection.x = mp->position.x;
+	mp->projection.y = y;
+}
+
+// This function updates the moving piece with a specific one.
+static int get_specific_piece(MovingPiece *mp, List list, int type) {
+	Piece piece = PIECES[type];
+	mp->position.x = BOARD_W / 2 - piece.size / 2;
+	mp->position.y = window_top(list);
+	mp->rotation = 0;
+	mp->type = type;
+	mp->structure = piece;
+	mp->current = get_oob_offset_node(NULL, NULL, 0, &mp->next, 
+		list_index_from_y(mp->position.y, list), list);
+
+	if (check_collisions(mp, list)) {
+		// Collided on generation. That means you lose :)
+		return 0;
+	}
+
+	get_projection(mp, list);
+
+	return 1;
+}
+
+// Each game has its own generator (xorshift), so games with the same seed 
+// get the same pieces.
+static uint32_t next_random(Game *game) {
+	game->rng ^= game->rng << 13;
+	game->rng ^= game->rng >> 17;
+	game->rng ^= game->rng << 5;
+
+	return game->rng;
+}
+
+// Pick a random piece type.
+static int random_type(Game *game) {
+	return next_random(game) % N_PIECES;
+}
+
+// This function gets the next piece and updates the new next.
+// If type is -1, it also randomises the first piece (used for initiating)
+static int get_next_piece(Game *game, int type) {
+	if (type == -1) {
+		type = random_type(game);
+	}
+
+	game->next_type = random_type(game);
+
+	return get_specific_piece(&game->mp, game->list, type);
+}
+
+// This function attempts the rotation of the moving piece, according to SRS.
+// https://tetris.wiki/Super_Rotation_System
+static void rotate(MovingPiece *mp, List list) {
+	TRACE_SCOPE(TRACE_ROTATE);
+	int tries = 0;
+
+	while (tries < N_ORIENTATIONS[mp->type]) {
+		tries++;
+
+		mp->rotation = (mp->rotation + 1) % N_ORIENTATIONS[mp->type];
+		mp->structure = ORIENTATIONS[mp->type][mp->rotation];
+
+		// Regular rotation
+		if (!check_collisions(mp, list)) {
+			break;
+		}
+
+		// Help the player by trying to increment or decrement x
+		mp->position.x--;
+		if (!check_collisions(mp, list)) {
+			break;
+		}
+
+		// Go one further if it's a long piece (like the line)
+		if (mp->structure.size >= 4) {
+			mp->position.x--;
+			if (!check_collisions(mp, list)) {
+				break;
+			}
+			mp->position.x++;
+		}
+
+		mp->position.x = mp->position.x + 2;
+		if (!check_collisions(mp, list)) {
+			break;
+		}
+
+		// Go one further if it's a long piece (like the line)
+		if (mp->structure.size >= 4) {
+			mp->position.x++;
+			if (!check_collisions(mp, list)) {
+				break;
+			}
+			mp->position.x--;
+		}
+
+		mp->position.x--;
+	}
+}
+
+// Move the piece up to steps columns in a direction, stopping at the first 
+// collision. The projection is only updated once. Returns the columns moved.
+static int shift(MovingPiece *mp, List list, int direction, int steps) {
+	int moved = 0;
+
+	while (moved < steps && !collides_at(&mp->structure, 
+		mp->position.x + direction, mp->position.y, list)) {
+		mp->position.x += direction;
+		moved++;
+	}
+
+	if (moved > 0) {
+		get_projection(mp, list);
+	}
+
+	return moved;
+}
+
+// This function checks if a line is complete.
+static int line_complete(Node *node) {
+	return node->mask == FULL_ROW;
+}
+
+// This function checks for completed lines starting from the given node, up to 
+// check_upto lines. If any completed line is found, break it. The number of 
+// lines broken is saved in lines_cleared.
+static int check_break_lines(List *list, Node *node, Node *next,
+							  int check_upto, int level, int *lines_cleared) {
+	TRACE_SCOPE(TRACE_CHECK_BREAK_LINES);
+
+	int base_score = 0;
+
+	while (node != NULL && check_upto > 0) {
+		if (line_complete(node)) {
+			// Find prev node
+			Node *prev = get_offset_node(node, next, 1, NULL);
+			remove_node(list, node, prev);
+			node = prev;
+			(*lines_cleared)++;
+		} else {
+			// Keep going
+			node = get_offset_node(node, next, 1, &next);
+		}
+		check_upto--;
+	}
+
+	// Add base score depending on how many lines were broken
+	switch (*lines_cleared) {
+		case 1:
+			base_score = 100;
+			break;
+		case 2:
+			base_score = 300;
+			break;
+		case 3:
+			base_score = 500;
+			break;
+		case 4:
+			base_score = 800;
+			break;
+		default:
+			// Only pieces larger than tetrominoes clear more lines: 200 
+			// for each line, same as a tetris.
+			base_score = 200 * *lines_cleared;
+	}
+
+	return base_score * level;
+}
+
+// This function places the moving piece into the list. It returns the points 
+// awarded after placing the piece, and saves the lines it cleared. The hash 
+// of the board is updated: each block adds its key, and as clearing lines 
+// moves the rows above down, the rows from the bottom of the piece up are 
+// hashed again (only the piece is above them).
+static int place_piece(MovingPiece *mp, List *list, int level, 
+					   int *lines_cleared, uint64_t *hash) {
+	TRACE_SCOPE(TRACE_PLACE_PIECE);
+	int score = 0, bottom;
+	*lines_cleared = 0;
+
+	if (mp->current == NULL) {
+		while (list_index_from_y(mp->position.y, *list) > list->count - 1) {
+			mp->current = add_node(list);
+		}
+
+		mp->next = NULL;
+	}
+	
+	for (int i = 0; i < mp->structure.n_blocks; i++) {
+		Block block = mp->structure.blocks[i];
+		Node *node = get_offset_node(mp->current, mp->next, block.position.y, 
+			NULL);
+		node->value[mp->position.x + block.position.x] = block.colour;
+		node->mask |= 1 << (mp->position.x + block.position.x);
+		*hash ^= cell_key(list_index_from_y(mp->position.y + 
+			block.position.y, *list), mp->position.x + block.position.x);
+	}
+
+	bottom = list_index_from_y(mp->position.y + mp->structure.bottom, *list);
+	*hash ^= rows_key(*list, bottom);
+	score += check_break_lines(list, mp->current, mp->next, 
+		mp->structure.bottom + 1, level, lines_cleared);
+	*hash ^= rows_key(*list, bottom);
+	return score;
+}
+
+// Advance level if needed.
+const void level_advancer(int score, int *level, float *gravity) {
+	int cond;
+
+	while (1) {
+		cond = (score > (*level * (*level + 1)) / 2 * 1000);
+		if (*level >= 10) {
+			cond = (score > 10 / 2 * 11 * 1000 + (*level - 10) * 1000);
+		}
+
+		if (*level == MAX_LEVEL) {
+			cond = 0;
+		}
+
+		if (!cond) {
+			break;
+		}
+
+		*level = *level + 1;
+		*gravity = gravity_for_level(*level);
+	}
+}
+
+// Moving a grounded piece postpones locking, a limited amount of times.
+static void postpone_lock(FallState *fall) {
+	if (fall->lock_ticks > 0 && fall->lock_resets < MAX_LOCK_RESETS) {
+		fall->lock_ticks = 0;
+		fall->lock_resets++;
+	}
+}
+
+// Reset the falling state for a freshly spawned piece.
+static void reset_fall(FallState *fall, MovingPiece mp) {
+	fall->progress = 0.0;
+	fall->lock_ticks = 0;
+	fall->lock_resets = 0;
+	fall->lowest_y = mp.position.y;
+}
+
+// Start a new game on a board with a certain number of rows (BOARD_H, or 
+// more for tall boards). Games with the same seed get the same pieces.
+void create_game(Game *game, uint32_t seed, int height) {
+	game->list = create_list(height);
+	game->hash = 0;
+	game->rng = (seed == 0) ? 1 : seed;	// xorshift gets stuck on 0
+	game->held_type = -1;
+	game->has_held = 0;
+	game->score = 0;
+	game->level = 1;
+	game->lines_cleared = 0;
+	game->placed_type = -1;
+	game->on_place = NULL;
+	game->on_place_data = NULL;
+
+	get_next_piece(game, -1);
+	game->falling.gravity = gravity_for_level(game->level);
+	reset_fall(&game->falling, game->mp);
+}
+
+void free_game(Game *game) {
+	free_list(&game->list);
+}
+
+// Save the rows of the board as masks (row 0 is the top). On tall boards, 
+// these are the rows of the window pieces spawn in.
+void get_board(List list, uint16_t board[BOARD_H]) {
+	int top = window_top(list);
+
+	for (int y = 0; y < BOARD_H; y++) {
+		Node *node = get_node(list, list_index_from_y(top + y, list));
+		board[y] = (node != NULL) ? node->mask : 0;
+	}
+}
+
+// Set the blocks of a row that isn't made of pieces.
+static void fill_row(Node *node, uint16_t mask) {
+	node->mask = mask;
+	for (int i = 0; i < BOARD_W; i++) {
+		node->value[i] = ((mask >> i) & 1) ? GARBAGE_COLOUR : 0;
+	}
+}
+
+// Replace the bottom rows of the board of a game, given as row masks (row 0 
+// is the top). The moving piece goes back to where it spawned.
+void game_set_board(Game *game, const uint16_t board[BOARD_H]) {
+	int top = 0;
+
+	free_list(&game->list);
+	while (top < BOARD_H && board[top] == 0) {
+		top++;
+	}
+
+	for (int y = BOARD_H - 1; y >= top; y--) {
+		fill_row(add_node(&game->list), board[y]);
+	}
+
+	game->hash = rows_key(game->list, 0);
+
+	get_specific_piece(&game->mp, game->list, game->mp.type);
+	reset_fall(&game->falling, game->mp);
+}
+
+// Fill up to a number of rows at the bottom of an empty board with garbage: 
+// each row has one hole, in a random column. The moving piece spawns again, 
+// above the garbage.
+void game_dig(Game *game, int rows) {
+	for (int i = 0; i < rows && game->list.count < game->list.height; i++) {
+		int hole = next_random(game) % BOARD_W;
+		fill_row(add_node(&game->list), FULL_ROW & ~(1 << hole));
+	}
+
+	game->hash = rows_key(game->list, 0);
+
+	get_specific_piece(&game->mp, game->list, game->mp.type);
+	reset_fall(&game->falling, game->mp);
+}
+
+// Replace the moving piece with a new piece of a certain type. Returns 0 if 
+// it has no room to spawn.
+int game_spawn(Game *game, int type) {
+	int spawned = get_specific_piece(&game->mp, game->list, type);
+	reset_fall(&game->falling, game->mp);
+	return spawned;
+}
+
+// Pack the state of a piece in one word: bits 0-4 have the type, 5-6 the 
+// rotation, 7-11 x and 12-29 y (both biased, see STATE_BIAS). Bit 30 is 
+// always set, so a packed state is never 0.
+uint32_t pack_piece(const MovingPiece *mp) {
+	return mp->type | mp->rotation << 5 | 
+		(mp->position.x + STATE_BIAS) << 7 | 
+		(uint32_t)(mp->position.y + STATE_BIAS) << 12 | STATE_VALID;
+}
+
+// Move the moving piece to a packed state (see pack_piece), as if it had 
+// spawned there. Returns 0, leaving the piece where it was, if the state is 
+// invalid or collides.
+int game_set_piece(Game *game, uint32_t state) {
+	MovingPiece mp;
+	List list = game->list;
+	int type = state & 31, rotation = (state >> 5) & 3;
+
+	if (!(state & STATE_VALID) || type >= N_PIECES || 
+		rotation >= N_ORIENTATIONS[type]) {
+		return 0;
+	}
+
+	mp.type = type;
+	mp.rotation = rotation;
+	mp.structure = ORIENTATIONS[type][rotation];
+	mp.position.x = (int)((state >> 7) & 31) - STATE_BIAS;
+	mp.position.y = (int)((state >> 12) & ((1 << 18) - 1)) - STATE_BIAS;
+	if (mp.position.y + mp.structure.top < 0 || check_collisions(&mp, list)) {
+		return 0;
+	}
+
+	mp.current = get_oob_offset_node(NULL, NULL, 0, &mp.next, 
+		list_index_from_y(mp.position.y, list), list);
+	get_projection(&mp, list);
+	game->mp = mp;
+	reset_fall(&game->falling, game->mp);
+	return 1;
+}
+
+// Get the first n pieces dealt in a game with a certain seed.
+void game_pieces(uint32_t seed, int n, int *types) {
+	Game game;
+	game.rng = (seed == 0) ? 1 : seed;
+
+	for (int i = 0; i < n; i++) {
+		types[i] = random_type(&game);
+	}
+}
+
+// Place the moving piece and spawn the next one. Returns the game events.
+// The on_place hook sees the board as it was before placing the piece.
+static int lock_piece(Game *game) {
+	int events = GAME_MOVED | GAME_PLACED | GAME_NEXT;
+	int points, top = 0;
+	Placement placement;
+
+	if (game->on_place != NULL) {
+		get_board(game->list, placement.board);
+		top = window_top(game->list);
+	}
+
+	game->placed_type = game->mp.type;
+	points = place_piece(&game->mp, &game->list, game->level, 
+		&game->lines_cleared, &game->hash);
+	game->score += points;
+
+	if (game->on_place != NULL) {
+		placement.type = game->mp.type;
+		placement.rotation = game->mp.rotation;
+		placement.x = game->mp.position.x;
+		placement.y = game->mp.position.y - top;
+		placement.next_type = game->next_type;
+		placement.held_type = game->held_type;
+		placement.lines_cleared = game->lines_cleared;
+		placement.score = points;
+		game->on_place(game->on_place_data, &placement);
+	}
+
+	level_advancer(game->score, &game->level, &game->falling.gravity);
+	// Allow player to hold pieces again
+	game->has_held = 0;
+
+	if (!get_next_piece(game, game->next_type)) {
+		// Lose condition
+		events |= GAME_OVER;
+	}
+
+	reset_fall(&game->falling, game->mp);
+	return events;
+}
+
+// Move the piece up to steps columns left (-1) or right (1).
+int game_shift(Game *game, int direction, int steps) {
+	if (shift(&game->mp, game->list, direction, steps) == 0) {
+		return 0;
+	}
+
+	postpone_lock(&game->falling);
+	return GAME_MOVED;
+}
+
+// Rotate the piece in place. If every rotation collided, rotate gives the 
+// piece back where it was (after trying them all, it is in its orientation 
+// again).
+int game_rotate(Game *game) {
+	MovingPiece *mp = &game->mp;
+	int rotation = mp->rotation, x = mp->position.x;
+
+	rotate(mp, game->list);
+	if (mp->rotation == rotation && mp->position.x == x) {
+		// Every rotation collided
+		return 0;
+	}
+
+	get_projection(mp, game->list);
+	postpone_lock(&game->falling);
+	return GAME_MOVED;
+}
+
+int game_soft_drop(Game *game) {
+	if (!can_fall(&game->mp, game->list)) {
+		return 0;
+	}
+
+	move_down(&game->mp, game->list);
+	postpone_lock(&game->falling);
+	return GAME_MOVED;
+}
+
+// Send the piece to the bottom and place it right away.
+int game_hard_drop(Game *game) {
+	fall(&game->mp, game->list);
+	return lock_piece(game);
+}
+
+// Swap the moving piece with the held one (or the next one, if none is held). 
+// A piece can only be held once until the next one is placed.
+int game_hold(Game *game) {
+	int events = GAME_MOVED | GAME_HELD, spawned;
+
+	if (game->has_held) {
+		return 0;
+	}
+
+	game->has_held = 1;
+	if (game->held_type == -1) {
+		// No currently held piece, get from next.
+		game->held_type = game->mp.type;
+		spawned = get_next_piece(game, game->next_type);
+		events |= GAME_NEXT;
+	} else {
+		int tmp = game->mp.type;
+		spawned = get_specific_piece(&game->mp, game->list, game->held_type);
+		game->held_type = tmp;
+	}
+
+	if (!spawned) {
+		events |= GAME_OVER;
+	}
+
+	reset_fall(&game->falling, game->mp);
+	return events;
+}
+
+// Advance the game by one tick: apply gravity, and place the piece if it has 
+// been resting on the ground for long enough. Returns the game events.
+int game_tick(Game *game) {
+	FallState *falling = &game->falling;
+	int events = 0;
+
+	// Gravity: move down as many whole rows as have accumulated.
+	falling->progress += falling->gravity;
+	while (falling->progress >= 1.0) {
+		falling->progress -= 1.0;
+		if (!can_fall(&game->mp, game->list)) {
+			falling->progress = 0.0;
+			break;
+		}
+		move_down(&game->mp, game->list);
+		events |= GAME_MOVED;
+	}
+
+	if (game->mp.position.y > falling->lowest_y) {
+		// Reaching a new row earns the lock resets back.
+		falling->lowest_y = game->mp.position.y;
+		falling->lock_resets = 0;
+	}
+
+	if (can_fall(&game->mp, game->list)) {
+		falling->lock_ticks = 0;
+		return events;
+	}
+
+	falling->lock_ticks++;
+	if (falling->lock_ticks >= LOCK_DELAY_TICKS) {
+		events |= lock_piece(game);
+	}
+
+	return events;
+}
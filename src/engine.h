@@ -0,0 +1,17 @@
+void create_game(Game *game, uint32_t seed, int height);
+void free_game(Game *game);
+int game_shift(Game *game, int direction, int steps);
+int game_rotate(Game *game);
+int game_soft_drop(Game *game);
+int game_hard_drop(Game *game);
+int game_hold(Game *game);
+int game_tick(Game *game);
+int stack_height(List list);
+int board_view(List list, const MovingPiece *mp);
+void get_board(List list, uint16_t board[BOARD_H]);
+void game_set_board(Game *game, const uint16_t board[BOARD_H]);
+void game_dig(Game *game, int rows);
+int game_spawn(Game *game, int type);
+void game_pieces(uint32_t seed, int n, int *types);
+uint32_t pack_piece(const MovingPiece *mp);
+int game_set_piece(Game *game, uint32_t state);
\ No newline at end of file
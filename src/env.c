@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "structs.h"
+#include "pieces.h"
+#include "lists.h"
+#include "engine.h"
+#include "export.h"
+#include "env.h"
+
+_Static_assert(TETRIS_BOARD_W == BOARD_W && TETRIS_BOARD_H == BOARD_H,
+	"env.h must match the board size");
+
+struct tetris_envs {
+	Game *games;
+	Exporter *exporter;
+	int n;
+};
+
+// Write the observation of a game. Only the rows of the stack are walked; the
+// rows above it are cleared.
+static void observe(Game *game, TetrisObservation *observation) {
+	Node *node = game->list.start, *prev = NULL;
+	int y = BOARD_H - 1;
+
+	while (node != NULL && y >= 0) {
+		for (int i = 0; i < BOARD_W; i++) {
+			observation->board[y][i] = (node->mask >> i) & 1;
+		}
+		y--;
+		node = get_offset_node(node, prev, 1, &prev);
+	}
+
+	if (y >= 0) {
+		memset(observation->board, 0, (y + 1) * BOARD_W);
+	}
+
+	observation->type = game->mp.type;
+	observation->rotation = game->mp.rotation;
+	observation->x = game->mp.position.x;
+	observation->y = game->mp.position.y;
+	observation->next_type = game->next_type;
+	observation->held_type = game->held_type;
+	observation->can_hold = !game->has_held;
+	observation->score = game->score;
+	observation->level = game->level;
+}
+
+// Start the next game of an environment. Its seed comes from the generator of
+// the previous game, so a batch is reproducible from the seed it was created
+// with.
+static void restart(Game *game) {
+	uint32_t seed = game->rng;
+	void (*on_place)(void *data, const Placement *placement) = game->on_place;
+	void *on_place_data = game->on_place_data;
+
+	free_game(game);
+	create_game(game, seed, BOARD_H);
+	game->on_place = on_place;
+	game->on_place_data = on_place_data;
+}
+
+// Create n environments. Environment i is seeded with seed + i. The pieces
+// are shared by every environment in the process: the last folder loaded
+// wins. Returns NULL if the pieces can't be loaded.
+TetrisEnvs *tetris_create(int n, uint32_t seed, const char *pieces_folder) {
+	TetrisEnvs *envs;
+
+	if (n < 1 || !set_pieces(pieces_folder)) {
+		return NULL;
+	}
+
+	envs = malloc(sizeof(TetrisEnvs));
+	if (envs == NULL) {
+		return NULL;
+	}
+
+	envs->n = n;
+	envs->exporter = NULL;
+	envs->games = malloc(sizeof(Game) * n);
+	if (envs->games == NULL) {
+		free(envs);
+		return NULL;
+	}
+
+	for (int i = 0; i < n; i++) {
+		create_game(&envs->games[i], seed + i, BOARD_H);
+	}
+
+	return envs;
+}
+
+void tetris_destroy(TetrisEnvs *envs) {
+	tetris_export(envs, NULL);
+	for (int i = 0; i < envs->n; i++) {
+		free_game(&envs->games[i]);
+	}
+
+	free(envs->games);
+	free(envs);
+}
+
+// Export every placement made in any environment to a file (see export.c), 
+// or stop exporting if path is NULL. Returns 0 on success, -1 if the file 
+// could not be opened, or the previous one could not be written entirely.
+int tetris_export(TetrisEnvs *envs, const char *path) {
+	int result = 0;
+
+	if (envs->exporter != NULL && close_exporter(envs->exporter) != 0) {
+		result = -1;
+	}
+
+	envs->exporter = NULL;
+	if (path != NULL && (envs->exporter = open_exporter(path)) == NULL) {
+		result = -1;
+	}
+
+	for (int i = 0; i < envs->n; i++) {
+		envs->games[i].on_place = envs->exporter ? export_placement : NULL;
+		envs->games[i].on_place_data = envs->exporter;
+	}
+
+	return result;
+}
+
+// Lets bindings check that they lay out observations the same way.
+int tetris_observation_size() {
+	return sizeof(TetrisObservation);
+}
+
+// Start a new game in every environment, and write the first observations.
+void tetris_reset(TetrisEnvs *envs, TetrisObservation *observations) {
+	for (int i = 0; i < envs->n; i++) {
+		restart(&envs->games[i]);
+		observe(&envs->games[i], &observations[i]);
+	}
+}
+
+// Apply one action to each environment, then one tick of gravity. The reward
+// is the score gained. An environment that lost is marked as done and
+// restarted right away: its observation is the first one of the new game.
+void tetris_step(TetrisEnvs *envs, const uint8_t *actions,
+				 TetrisObservation *observations, float *rewards,
+				 uint8_t *dones) {
+	for (int i = 0; i < envs->n; i++) {
+		Game *game = &envs->games[i];
+		int old_score = game->score, events = 0;
+
+		switch (actions[i]) {
+			case TETRIS_LEFT:
+				events = game_shift(game, -1, 1);
+				break;
+			case TETRIS_RIGHT:
+				events = game_shift(game, 1, 1);
+				break;
+			case TETRIS_ROTATE:
+				events = game_rotate(game);
+				break;
+			case TETRIS_SOFT_DROP:
+				events = game_soft_drop(game);
+				break;
+			case TETRIS_HARD_DROP:
+				events = game_hard_drop(game);
+				break;
+			case TETRIS_HOLD:
+				events = game_hold(game);
+				break;
+		}
+
+		if (!(events & (GAME_PLACED | GAME_OVER))) {
+			events |= game_tick(game);
+		}
+
+		rewards[i] = game->score - old_score;
+		dones[i] = (events & GAME_OVER) != 0;
+		if (dones[i]) {
+			restart(game);
+		}
+
+		observe(game, &observations[i]);
+	}
+}
@@ -0,0 +1,44 @@
+// Batched environment API for reinforcement learning, built as libtetris.so 
+// (make lib). Every call works on all the environments at once, and writes 
+// straight into arrays owned by the caller: nothing is allocated per step.
+// Each step applies one action to each environment, then one tick of gravity.
+
+#include <stdint.h>
+
+#define TETRIS_API __attribute__((visibility("default")))
+
+#define TETRIS_BOARD_W 10
+#define TETRIS_BOARD_H 24
+
+enum {
+	TETRIS_NOOP,
+	TETRIS_LEFT,
+	TETRIS_RIGHT,
+	TETRIS_ROTATE,
+	TETRIS_SOFT_DROP,
+	TETRIS_HARD_DROP,
+	TETRIS_HOLD,
+	TETRIS_ACTIONS
+};
+
+// The observation of one environment. board has a 1 for every block placed 
+// (row 0 is the top). The moving piece is described by its type, orientation 
+// and the position of its grid. Types are -1 when there is no piece.
+typedef struct {
+	uint8_t board[TETRIS_BOARD_H][TETRIS_BOARD_W];
+	int8_t type, rotation, x, y;
+	int8_t next_type, held_type, can_hold, padding;
+	int32_t score, level;
+} TetrisObservation;
+
+typedef struct tetris_envs TetrisEnvs;
+
+TETRIS_API TetrisEnvs *tetris_create(int n, uint32_t seed, 
+									 const char *pieces_folder);
+TETRIS_API void tetris_destroy(TetrisEnvs *envs);
+TETRIS_API int tetris_export(TetrisEnvs *envs, const char *path);
+TETRIS_API int tetris_observation_size();
+TETRIS_API void tetris_reset(TetrisEnvs *envs, TetrisObservation *observations);
+TETRIS_API void tetris_step(TetrisEnvs *envs, const uint8_t *actions, 
+							TetrisObservation *observations, float *rewards, 
+							uint8_t *dones);
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "structs.h"
+
+#define MAGIC "TTRSMPL2"
+#define COLUMNS 9
+
+// Placements are exported in a binary, column-oriented format, in native
+// byte order. The file starts with a header:
+//     char magic[8] = "TTRSMPL2"; uint32_t board_w, board_h, block_size;
+// followed by blocks of up to block_size placements. Each block starts with
+// uint32_t count, then has one column per field, each count entries long:
+//     uint16_t board[count][board_h];	rows before placing, as in Placement
+//     int8_t type[count], rotation[count], x[count];
+//     int32_t y[count];	deeper than board on tall boards
+//     int8_t next_type[count], held_type[count];	-1 if none
+//     uint8_t lines_cleared[count];
+//     int32_t score[count];
+// Every column has a fixed width, so each one can be mapped as an array.
+
+typedef struct {
+	char magic[8];
+	uint32_t board_w, board_h, block_size;
+} ExportHeader;
+
+// Open a file to export placements into, replacing it. Returns NULL on error.
+Exporter *open_exporter(const char *path) {
+	Exporter *exporter = malloc(sizeof(Exporter));
+	ExportHeader header;
+
+	if (exporter == NULL) {
+		return NULL;
+	}
+
+	exporter->count = 0;
+	exporter->failed = 0;
+	exporter->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (exporter->fd == -1) {
+		free(exporter);
+		return NULL;
+	}
+
+	memcpy(header.magic, MAGIC, sizeof(header.magic));
+	header.board_w = BOARD_W;
+	header.board_h = BOARD_H;
+	header.block_size = EXPORT_BLOCK;
+	if (write(exporter->fd, &header, sizeof(header)) != sizeof(header)) {
+		close(exporter->fd);
+		free(exporter);
+		return NULL;
+	}
+
+	return exporter;
+}
+
+// Write the buffered placements as one block, with a single system call.
+static int flush_exporter(Exporter *exporter) {
+	uint32_t count = exporter->count;
+	struct iovec columns[COLUMNS + 1] = {
+		{&count, sizeof(count)},
+		{exporter->board, count * sizeof(exporter->board[0])},
+		{exporter->type, count},
+		{exporter->rotation, count},
+		{exporter->x, count},
+		{exporter->y, count * sizeof(exporter->y[0])},
+		{exporter->next_type, count},
+		{exporter->held_type, count},
+		{exporter->lines_cleared, count},
+		{exporter->score, count * sizeof(exporter->score[0])}
+	};
+	ssize_t size = 0;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	for (int i = 0; i <= COLUMNS; i++) {
+		size += columns[i].iov_len;
+	}
+
+	exporter->count = 0;
+	return (writev(exporter->fd, columns, COLUMNS + 1) == size) ? 0 : -1;
+}
+
+// Buffer a placement. Meant to be used as the on_place hook of a game, with
+// the exporter as its data. Only full blocks are written out.
+void export_placement(void *data, const Placement *placement) {
+	Exporter *exporter = data;
+	int i = exporter->count++;
+
+	memcpy(exporter->board[i], placement->board, sizeof(exporter->board[i]));
+	exporter->type[i] = placement->type;
+	exporter->rotation[i] = placement->rotation;
+	exporter->x[i] = placement->x;
+	exporter->y[i] = placement->y;
+	exporter->next_type[i] = placement->next_type;
+	exporter->held_type[i] = placement->held_type;
+	exporter->lines_cleared[i] = placement->lines_cleared;
+	exporter->score[i] = placement->score;
+
+	if (exporter->count == EXPORT_BLOCK && flush_exporter(exporter) != 0) {
+		exporter->failed = 1;
+	}
+}
+
+// Write the last placements and close the file. Returns 0 on success, -1 if
+// anything could not be written.
+int close_exporter(Exporter *exporter) {
+	int result = flush_exporter(exporter);
+
+	if (close(exporter->fd) != 0 || exporter->failed) {
+		result = -1;
+	}
+
+	free(exporter);
+	return result;
+}
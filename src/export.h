@@ -0,0 +1,3 @@
+Exporter *open_exporter(const char *path);
+void export_placement(void *data, const Placement *placement);
+int close_exporter(Exporter *exporter);
\ No newline at end of file
@@ -0,0 +1,240 @@
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ncurses.h>
+
+#include "structs.h"
+#include "clock.h"
+#include "trace.h"
+
+// Terminal input is read on its own thread, so a key is never kept waiting
+// behind drawing or the tick sleep. Only the key codes of ncurses are used
+// here: ncurses itself is not thread safe, and stays on the render thread.
+//
+// Terminals that implement the kitty keyboard protocol are asked to report
+// repeats and releases of the keys they send as escape codes, like arrows:
+// ESC [ 1 ; mods : event D, with event 2 for a repeat and 3 for a release.
+// Other terminals ignore the request, and only send presses (repeats look
+// like presses). The terminal says which it is in its answer to
+// KEYBOARD_QUERY.
+
+#define ESC 27
+#define MASK (INPUT_QUEUE_SIZE - 1)
+#define CURSOR_REPORT -2	// ESC [ row ; col R, the answer to ESC [ 6 n
+#define FLAGS_REPORT -3		// ESC [ ? flags u, the answer to KEYBOARD_QUERY
+#define MAX_NUMBER 100000	// larger parameters are clamped
+
+#define KEYBOARD_PUSH "\033[>2u"	// report event types, until popped
+#define KEYBOARD_QUERY "\033[?u"
+#define KEYBOARD_POP "\033[<u"
+#define EVENT_TYPES 2	// the flag of KEYBOARD_PUSH
+
+enum {
+	DECODE_KEY,
+	DECODE_ESCAPE,
+	DECODE_SEQUENCE		// after ESC [ (CSI) or ESC O (SS3)
+};
+
+// Escape sequences are decoded one byte at a time, across reads. In a
+// sequence, number is the number being read, field counts the parameters
+// before it (separated by ;) and sub its sub-parameters (separated by :).
+// first is the first parameter, event the type of the key (see InputEvent),
+// and query is set if the sequence starts with ?.
+typedef struct {
+	int state, number, field, sub;
+	int first, event, query;
+} Decoder;
+
+static pthread_t input_thread;
+static volatile sig_atomic_t resized = 0;
+static long long reported = 0;
+static int releases = 0;
+
+// Push a key. The queue is only full if the game stopped taking keys: the
+// key is dropped then.
+static void push_input(InputQueue *queue, int key, int type, long long time) {
+	unsigned head = queue->head;
+
+	if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) ==
+		INPUT_QUEUE_SIZE) {
+		return;
+	}
+
+	queue->events[head & MASK].key = key;
+	queue->events[head & MASK].type = type;
+	queue->events[head & MASK].time = time;
+	// Publish the event to the game
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Keep the number just read, if it is one the game uses.
+static void end_number(Decoder *decoder) {
+	if (decoder->field == 0 && decoder->sub == 0) {
+		decoder->first = decoder->number;
+	} else if (decoder->field == 1 && decoder->sub == 1) {
+		decoder->event = decoder->number;
+	}
+
+	decoder->number = 0;
+}
+
+// Decode a byte. Returns the key it completes (with its type in event),
+// CURSOR_REPORT, FLAGS_REPORT, or -1 if none.
+static int decode(Decoder *decoder, unsigned char byte) {
+	switch (decoder->state) {
+		case DECODE_ESCAPE:
+			if (byte == '[' || byte == 'O') {
+				decoder->state = DECODE_SEQUENCE;
+				decoder->number = decoder->field = decoder->sub = 0;
+				decoder->first = decoder->query = 0;
+				decoder->event = INPUT_PRESS;
+				return -1;
+			}
+			if (byte == ESC) {
+				return -1;
+			}
+			// A lone escape: ignore it, and read the byte as a key
+			decoder->state = DECODE_KEY;
+			decoder->event = INPUT_PRESS;
+			return byte;
+		case DECODE_SEQUENCE:
+			if (byte >= '0' && byte <= '9') {
+				decoder->number = decoder->number * 10 + (byte - '0');
+				if (decoder->number > MAX_NUMBER) {
+					decoder->number = MAX_NUMBER;
+				}
+				return -1;
+			}
+			if (byte == '?') {
+				decoder->query = 1;
+				return -1;
+			}
+			if (byte >= 0x30 && byte <= 0x3f) {
+				// Separators, like in ESC [ 1 ; 2 : 3 A
+				end_number(decoder);
+				if (byte == ';') {
+					decoder->field++;
+					decoder->sub = 0;
+				} else if (byte == ':') {
+					decoder->sub++;
+				}
+				return -1;
+			}
+
+			end_number(decoder);
+			decoder->state = DECODE_KEY;
+			switch (byte) {
+				case 'A':
+					return KEY_UP;
+				case 'B':
+					return KEY_DOWN;
+				case 'C':
+					return KEY_RIGHT;
+				case 'D':
+					return KEY_LEFT;
+				case 'R':
+					return CURSOR_REPORT;
+				case 'u':
+					return decoder->query ? FLAGS_REPORT : -1;
+				default:
+					return -1;
+			}
+		default:
+			if (byte == ESC) {
+				decoder->state = DECODE_ESCAPE;
+				return -1;
+			}
+			decoder->event = INPUT_PRESS;
+			return byte;
+	}
+}
+
+// Read stdin until the thread is cancelled. Every key of a read gets the time
+// the read returned at.
+static void *read_input(void *data) {
+	InputQueue *queue = data;
+	unsigned char buffer[64];
+	Decoder decoder = {DECODE_KEY};
+
+	while (1) {
+		ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+		long long now = time_ns();
+		TRACE_SCOPE(TRACE_DECODE_INPUT);
+
+		if (length <= 0) {
+			// Nothing more to read (stdin was closed)
+			return NULL;
+		}
+
+		for (int i = 0; i < length; i++) {
+			int key = decode(&decoder, buffer[i]);
+			if (key == CURSOR_REPORT) {
+				__atomic_store_n(&reported, now, __ATOMIC_RELEASE);
+			} else if (key == FLAGS_REPORT) {
+				__atomic_store_n(&releases, 
+					(decoder.first & EVENT_TYPES) != 0, __ATOMIC_RELEASE);
+			} else if (key != -1) {
+				push_input(queue, key, decoder.event, now);
+			}
+		}
+	}
+}
+
+static void on_resize(int signal) {
+	resized = 1;
+}
+
+// Start reading keys into a queue, and ask the terminal to report releases.
+// ncurses must be started already (with cbreak): SIGWINCH is handled here 
+// instead, as wgetch is no longer called.
+void start_input(InputQueue *queue) {
+	queue->head = queue->tail = 0;
+	signal(SIGWINCH, on_resize);
+	write(STDOUT_FILENO, KEYBOARD_PUSH KEYBOARD_QUERY, 
+		sizeof(KEYBOARD_PUSH KEYBOARD_QUERY) - 1);
+	pthread_create(&input_thread, NULL, read_input, queue);
+}
+
+// Stop reading keys, and give the terminal back its keyboard mode.
+void stop_input() {
+	pthread_cancel(input_thread);
+	pthread_join(input_thread, NULL);
+	write(STDOUT_FILENO, KEYBOARD_POP, sizeof(KEYBOARD_POP) - 1);
+}
+
+// Get the oldest key without taking it. Returns 0 if there is none.
+int peek_input(InputQueue *queue, InputEvent *event) {
+	unsigned tail = queue->tail;
+
+	if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == tail) {
+		return 0;
+	}
+
+	*event = queue->events[tail & MASK];
+	return 1;
+}
+
+// Take the oldest key, leaving its slot to the input thread.
+void pop_input(InputQueue *queue) {
+	__atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+}
+
+// Check whether the terminal reports key repeats and releases.
+int key_releases() {
+	return __atomic_load_n(&releases, __ATOMIC_ACQUIRE);
+}
+
+// Get the time the terminal last reported its cursor position, or 0.
+long long last_report() {
+	return __atomic_load_n(&reported, __ATOMIC_ACQUIRE);
+}
+
+// Check whether the terminal was resized since the last call.
+int take_resize() {
+	if (!resized) {
+		return 0;
+	}
+
+	resized = 0;
+	return 1;
+}
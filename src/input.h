@@ -0,0 +1,7 @@
+void start_input(InputQueue *queue);
+void stop_input();
+int peek_input(InputQueue *queue, InputEvent *event);
+void pop_input(InputQueue *queue);
+int take_resize();
+long long last_report();
+int key_releases();
\ No newline at end of file
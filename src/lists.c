@@ -1,18 +1,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "structs.h"
 
 #define OUT_OF_MEMORY "out of memory\n"
+#define MIN_CAPACITY 32	// rows the row array starts with
 #define XOR(a, b) (Node *)((intptr_t)(a)^(intptr_t)(b))
 
-// Create a list
-List create_list() {
+// Create a list for a board with a certain number of rows
+List create_list(int height) {
 	List list;
 	list.start = NULL;
 	list.end = NULL;
 	list.count = 0;
+	list.rows = NULL;
+	list.capacity = 0;
+	list.height = height;
 	
 	return list;
 }
@@ -31,11 +36,23 @@ Node *add_node(List *list) {
 	for (int i = 0; i < BOARD_W; i++) {
 		node->value[i] = 0;
 	}
+	node->mask = 0;
 	
 	if (node->value == NULL) {
 		printf(OUT_OF_MEMORY);
 		exit(-1);
 	}
+
+	if (list->count > list->capacity) {
+		list->capacity = (list->capacity == 0) ? MIN_CAPACITY : 
+			2 * list->capacity;
+		list->rows = realloc(list->rows, sizeof(Node *) * list->capacity);
+		if (list->rows == NULL) {
+			printf(OUT_OF_MEMORY);
+			exit(-1);
+		}
+	}
+	list->rows[list->count - 1] = node;
 	
 	if (list->end == NULL) {
 		list->start = node;
@@ -53,8 +70,17 @@ Node *add_node(List *list) {
 }
 
 // Remove node from list. This requires knowing what the previous node is.
+// The rows above it move down in the row array, so removing a row near the 
+// top is cheap.
 void remove_node(List *list, Node *node, Node *prev) {
 	Node *next = XOR(node->link, prev);	// to be prev's new next!
+	int index = list->count - 1;
+
+	while (list->rows[index] != node) {
+		index--;
+	}
+	memmove(&list->rows[index], &list->rows[index + 1], 
+		sizeof(Node *) * (list->count - 1 - index));
 	
 	if (next != NULL) {
 		Node *nextnext = XOR(next->link, node);	// update next's prev with this
@@ -77,9 +103,23 @@ void remove_node(List *list, Node *node, Node *prev) {
 
 // Frees the list.
 void free_list(List *list) {
-	while (list->start != NULL) {
-		remove_node(list, list->start, NULL);
+	for (int i = 0; i < list->count; i++) {
+		free(list->rows[i]->value);
+		free(list->rows[i]);
+	}
+
+	free(list->rows);
+	*list = create_list(list->height);
+}
+
+// Get the node at an index (0 is the bottom row) in constant time. Returns 
+// NULL if there is no such node.
+Node *get_node(List list, int index) {
+	if (index < 0 || index >= list.count) {
+		return NULL;
 	}
+
+	return list.rows[index];
 }
 
 // This function returns the node offset positions away from the current node.
@@ -149,13 +189,18 @@ Node *get_offset_node(Node *node, Node *near, int offset, Node **newnear) {
 }
 
 // This function wraps around get_offset_node. It is used for getting nodes 
-// from OOB (out of bounds) positions.
+// from OOB (out of bounds) positions: the node offset rows below index, 
+// which is above the list, is looked up directly.
 Node *get_oob_offset_node(Node *node, Node *near, int offset, Node **newnear, 
 						  int index, List list) {
 	if (near == NULL && node == NULL) {
-		offset -= index - (list.count - 1);
-		node = list.end;
-		near = NULL;
+		index -= offset;
+		if (newnear != NULL) {
+			// Same as walking down from the end
+			*newnear = (index >= -1) ? get_node(list, index + 1) : NULL;
+		}
+
+		return get_node(list, index);
 	}
 
 	return get_offset_node(node, near, offset, newnear);
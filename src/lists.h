@@ -1,7 +1,9 @@
-List create_list();
+List create_list(int height);
 Node *add_node(List *list);
 void remove_node(List *list, Node *node, Node *prev);
 Node *get_offset_node(Node *node, Node *near, int offset, Node **newnear);
 Node *get_oob_offset_node(Node *node, Node *near, int offset, Node **newnear, 
 						  int index, List list);
 void free_list(List *list);
+
+Node *get_node(List list, int index);
\ No newline at end of file
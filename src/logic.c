@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <ncurses.h>
 
 #include "structs.h"
@@ -8,475 +11,425 @@
 #include "pieces.h"
 #include "lists.h"
 #include "render.h"
-
-#define TICKRATE 25.0
-
-extern Piece PIECES[N_PIECES];
-extern Piece ROTATED_PIECES[N_PIECES][ROTATIONS];
-
-// Sleep in milliseconds
-static void sleep_ms(int ms) {
+#include "engine.h"
+#include "stats.h"
+#include "export.h"
+#include "input.h"
+#include "bot.h"
+#include "clock.h"
+#include "trace.h"
+
+// The simulation runs at a fixed rate, independent of how long drawing takes.
+#define TICK_NS (1000000000LL / SIM_RATE)
+// If the loop falls this many ticks behind, skip ahead instead of catching up.
+#define MAX_CATCHUP_TICKS 10
+
+// Most terminals only report key presses, and repeat them while a key is 
+// held: a left/right key counts as held while its repeats keep arriving less 
+// than HOLD_GAP_NS apart. The first repeat, which looks like a press, comes 
+// MIN_REPEAT_DELAY_NS to MAX_REPEAT_DELAY_NS after the press.
+#define HOLD_GAP_NS (100 * 1000000LL)
+#define MIN_REPEAT_DELAY_NS (150 * 1000000LL)
+#define MAX_REPEAT_DELAY_NS (700 * 1000000LL)
+
+// How often a paused game checks whether it can go on
+#define PAUSE_POLL_NS (20 * 1000000LL)
+
+// Keys the bot may press to play a move, the hard drop included
+#define MAX_BOT_KEYS (MAX_ORIENTATIONS + BOARD_W + 2)
+
+extern int N_PIECES;
+
+// Sleep until the monotonic clock reaches deadline (in nanoseconds).
+static void sleep_until(long long deadline) {
+	TRACE_SCOPE(TRACE_SLEEP);
 	struct timespec ts;
-	ts.tv_sec = 0;
-	ts.tv_nsec = ms * 1000 * 1000;
-	nanosleep(&ts, NULL);
+	ts.tv_sec = deadline / 1000000000LL;
+	ts.tv_nsec = deadline % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0);
 }
 
-// Find what list index a y coordinate would translate to
-static int list_index_from_y(int y) {
-	return BOARD_H - 1 - y;
+static AutoShift create_auto_shift(Settings settings) {
+	AutoShift as;
+	as.direction = 0;
+	as.held = as.releases = as.repeating = 0;
+	as.das = settings.das * 1000000LL;
+	as.arr = settings.arr * 1000000LL;
+	as.das_start = as.last_seen = as.gap = as.interval = as.next_shift = 0;
+
+	return as;
 }
 
-// This function checks if there is a collision between the moving piece and 
-// the static blocks (saved in the XOR linked list) or the boundary.
-static int check_collisions(MovingPiece mp, List list) {
-	for (int i = 0; i < mp.structure.n_blocks; i++) {
-		Block block = mp.structure.blocks[i];
-		int offset_y = block.position.y;
-		int offset_x = block.position.x;
-
-		if (mp.position.x + offset_x < 0 || 
-			mp.position.x + offset_x >= BOARD_W) {
-			// Collision with the left-right boundary
-			return 1;
+// This function handles a left/right key event received at time now. A 
+// press moves the piece once, right away. If the terminal reports releases, 
+// the key is held until it is released; otherwise a key arriving quickly 
+// after the first repeat is a repeat too, and the key is held while they 
+// keep coming. Once das has passed since the press, auto_shift shifts the 
+// piece while the key is held. Returns the game events.
+static int shift_key(AutoShift *as, Game *game, int direction, int type, 
+					 long long now) {
+	int same = (direction == as->direction);
+	long long gap = now - as->last_seen;
+
+	if (as->releases) {
+		if (type == INPUT_RELEASE && same) {
+			as->direction = 0;
+			as->held = 0;
 		}
 
-		if (list_index_from_y(mp.position.y + offset_y) >= list.count) {
-			// This line does not exist in the list, no collision here.
-			continue;
+		if (type != INPUT_PRESS) {
+			return 0;
 		}
-
-		// This line exists in the list.
-		Node *line = get_oob_offset_node(mp.current, mp.next, offset_y, NULL, 
-			list_index_from_y(mp.position.y), list);
-		if (line == NULL) {
-			// Collision with the ground
-			return 1;
+	} else if (type == INPUT_RELEASE) {
+		return 0;
+	} else if (same && gap <= HOLD_GAP_NS && (as->repeating || 
+		(as->gap >= MIN_REPEAT_DELAY_NS && as->gap <= MAX_REPEAT_DELAY_NS))) {
+		if (!as->repeating) {
+			// The key before was the first repeat, not a press
+			as->repeating = 1;
+			as->das_start = as->last_seen - as->gap;
 		}
-		if (line->value[mp.position.x + offset_x] != 0) {
-			// Collision with a block
-			return 1;
+
+		as->gap = as->interval = gap;
+		as->last_seen = now;
+		if (!as->held && now - as->das_start >= as->das) {
+			as->held = 1;
+			as->next_shift = now;
 		}
+		return 0;
 	}
 
-	return 0;
+	as->gap = same ? gap : 0;
+	as->direction = direction;
+	as->held = 0;
+	as->repeating = 0;
+	as->das_start = as->last_seen = now;
+	return game_shift(game, direction, 1);
 }
 
-// This function does a collision check on the updated moving piece. If there 
-// are no collisions, it updates the moving piece.
-// This will only work as intended with one update at a time!
-static int advance(MovingPiece *mp, MovingPiece *upd, List list) {
-	if (check_collisions(*upd, list)) {
-		// Collision -> advance not successful
-		return 0;
+// This function shifts the piece while a left/right key is held, every arr 
+// nanoseconds or all the way to the wall at once if arr is 0. Without 
+// releases, it doesn't shift past the time the next repeat is due, so that a 
+// released key doesn't move the piece any further. Returns the game events.
+static int auto_shift(AutoShift *as, Game *game, long long now) {
+	long long until = now;
+	int steps = 0;
+
+	if (as->releases) {
+		if (as->direction != 0 && !as->held && 
+			now - as->das_start >= as->das) {
+			as->held = 1;
+			as->next_shift = as->das_start + as->das;
+		}
+	} else if (as->held && now - as->last_seen > HOLD_GAP_NS) {
+		// No more repeats: the key was released.
+		as->held = 0;
+	} else if (as->last_seen + as->interval < now) {
+		until = as->last_seen + as->interval;
 	}
 
-	*mp = *upd;
-	return 1;
-}
-
-static void move_down(MovingPiece *upd, List list) {
-	upd->current = get_oob_offset_node(upd->current, upd->next, 1, &upd->next, 
-		list_index_from_y(upd->position.y), list);
-	upd->position.y++;
-}
+	if (!as->held) {
+		return 0;
+	}
 
-// Forcefully make a piece fall (equivalent to spacebar on most implementations)
-static void fall(MovingPiece *mp, List list) {
-	MovingPiece upd;
-	do {
-		upd = *mp;
-		move_down(&upd, list);
-	} while (advance(mp, &upd, list));
-}
+	if (as->arr == 0) {
+		return game_shift(game, as->direction, BOARD_W);
+	}
 
-// Update the projection coordinates of a piece. A projection is a preview of 
-// the piece position if the user were to force fall.
-static void get_projection(MovingPiece *mp, List list) {
-	MovingPiece upd;
-	upd = *mp;
-	fall(&upd, list);
-	mp->projection = upd.position;
-}
+	while (as->next_shift <= until) {
+		as->next_shift += as->arr;
+		steps++;
+	}
 
-// This function updates the moving piece with a specific one.
-static int get_specific_piece(MovingPiece *mp, List list, int type) {
-	Piece piece = PIECES[type];
-	mp->position.x = BOARD_W / 2 - piece.center.x;
-	mp->position.y = 0;
-	mp->rotation = -1;
-	mp->type = type;
-	mp->structure = piece;
-	mp->current = get_oob_offset_node(NULL, NULL, mp->position.y, &mp->next, 
-		BOARD_H, list);
-
-	if (check_collisions(*mp, list)) {
-		// Collided on generation. That means you lose :)
+	if (steps == 0) {
 		return 0;
 	}
 
-	get_projection(mp, list);
-
-	return 1;
+	return game_shift(game, as->direction, steps);
 }
 
-// This function gets the next piece and updates the new next.
-// If type is -1, it also randomises the first piece (used for initiating)
-static int get_next_piece(MovingPiece *mp, List list, int type, 
-						  int *next_type) {
-	if (type == -1) {
-		type = rand() % N_PIECES;
+// Handle a key event (a press, a repeat or a release) at a certain time. 
+// Returns the game events.
+static int press_key(AutoShift *as, Game *game, int key, int type, 
+					 long long time) {
+	if (key == KEY_LEFT || key == KEY_RIGHT) {
+		return shift_key(as, game, (key == KEY_LEFT) ? -1 : 1, type, time);
+	} else if (type == INPUT_RELEASE) {
+		return 0;
+	} else if (key == KEY_UP) {
+		return game_rotate(game);
+	} else if (key == KEY_DOWN) {
+		return game_soft_drop(game);
+	} else if (key == ' ') {
+		return game_hard_drop(game);
+	} else if (key == 'c' || key == 'C') {
+		return game_hold(game);
 	}
 
-	*next_type = rand() % N_PIECES;
-
-	return get_specific_piece(mp, list, type);
+	return 0;
 }
 
-// This function attempts the rotation of the moving piece, according to SRS.
-// https://tetris.wiki/Super_Rotation_System
-static void rotate(MovingPiece *mp, List list) {
-	int tries = 0;
+// The next key to press for a move of the bot.
+static int bot_key(const Game *game, const BotMove *move) {
+	if (move->hold && !game->has_held) {
+		return 'c';
+	}
 
-	while (tries < ROTATIONS) {
-		tries++;
+	if (game->mp.type != move->type) {
+		return ' ';
+	}
 
-		mp->rotation++;
-		if (mp->rotation == ROTATIONS) {
-			mp->rotation = -1;
-		}
+	if (game->mp.rotation != move->rotation) {
+		return KEY_UP;
+	}
 
-		if (mp->rotation == -1) {
-			mp->structure = PIECES[mp->type];
-		} else {
-			mp->structure = ROTATED_PIECES[mp->type][mp->rotation];
-		}
+	if (game->mp.position.x != move->x) {
+		return (game->mp.position.x < move->x) ? KEY_RIGHT : KEY_LEFT;
+	}
 
-		// Regular rotation
-		if (!check_collisions(*mp, list)) {
-			break;
-		}
+	return ' ';
+}
 
-		// Help the player by trying to increment or decrement x
-		mp->position.x--;
-		if (!check_collisions(*mp, list)) {
-			break;
-		}
+// Play a move of the bot with the keys a player would press, ending with a 
+// hard drop. The piece may have fallen while the bot was thinking: if a key 
+// does nothing (a blocked shift or rotation), the piece is dropped where it 
+// is. Returns the game events, and counts the keys in inputs.
+static int play_move(AutoShift *as, Game *game, const BotMove *move, 
+					 long long now, int *inputs) {
+	int events = 0, stuck = 0;
+
+	for (int keys = 1; !(events & (GAME_PLACED | GAME_OVER)); keys++) {
+		int key = (stuck || keys == MAX_BOT_KEYS) ? ' ' : bot_key(game, move);
+		int result;
+
+		// Every key of the bot is a press, never a repeat
+		as->direction = 0;
+		result = press_key(as, game, key, INPUT_PRESS, now);
+
+		stuck = !(result & GAME_MOVED);
+		events |= result;
+		(*inputs)++;
+	}
 
-		// Go one further if it's a line
-		if (mp->type == 0) {
-			mp->position.x--;
-			if (!check_collisions(*mp, list)) {
-				break;
-			}
-			mp->position.x++;
-		}
+	return events;
+}
 
-		mp->position.x = mp->position.x + 2;
-		if (!check_collisions(*mp, list)) {
-			break;
+// Write what the render thread needs to draw the game into a frame: the rows 
+// on screen and the positions of the piece, relative to the top of the view.
+void take_snapshot(Game *game, Frame *frame) {
+	TRACE_SCOPE(TRACE_TAKE_SNAPSHOT);
+	List list = game->list;
+	int top = board_view(list, &game->mp);
+
+	for (int y = 0; y < BOARD_H; y++) {
+		Node *node = get_node(list, list.height - 1 - (top + y));
+		if (node == NULL) {
+			memset(frame->cells[y], 0, BOARD_W);
+			continue;
 		}
 
-		// Go one further if it's a line
-		if (mp->type == 0) {
-			mp->position.x++;
-			if (!check_collisions(*mp, list)) {
-				break;
-			}
-			mp->position.x--;
+		for (int i = 0; i < BOARD_W; i++) {
+			frame->cells[y][i] = node->value[i];
 		}
-
-		mp->position.x--;
 	}
-}
 
-// This function updates the moving piece accordingly.
-static void input_updater(MovingPiece *upd, int ch, List list) {
-	switch (ch) {
-		case KEY_LEFT:
-			upd->position.x--;
-			get_projection(upd, list);
-			break;
-		case KEY_RIGHT:
-			upd->position.x++;
-			get_projection(upd, list);
-			break;
-		case KEY_DOWN:
-			move_down(upd, list);
-			break;
-		case KEY_UP:
-			rotate(upd, list);
-			get_projection(upd, list);
-			break;
-		// Space treated separately in begin
-		// C treated separately in begin
-	}
+	frame->piece = game->mp.structure;
+	frame->position = game->mp.position;
+	frame->position.y -= top;
+	frame->projection = game->mp.projection;
+	frame->projection.y -= top;
+	frame->next_type = game->next_type;
+	frame->held_type = game->held_type;
+	frame->score = game->score;
+	frame->level = game->level;
 }
 
-// This function checks if a line is complete.
-static int line_complete(Node *node) {
-	for (int i = 0; i < BOARD_W; i++) {
-		if (node->value[i] == 0) {
-			return 0;
-		}
-	}
-	
-	return 1;
+// Add the time passed since mark to a phase of the tick, and move the mark.
+static void charge(long long *phase, long long *mark) {
+	long long now = time_ns();
+	*phase += now - *mark;
+	*mark = now;
 }
 
-// This function checks for completed lines starting from the given node, up to 
-// check_upto lines. If any completed line is found, break it.
-static int check_break_lines(List *list, Node *node, Node *next,
-							  int check_upto, int level) {
-
-	int base_score = 0;
-	int lines_cleared = 0;
-
-	while (node != NULL && check_upto > 0) {
-		if (line_complete(node)) {
-			// Find prev node
-			Node *prev = get_offset_node(node, next, 1, NULL);
-			remove_node(list, node, prev);
-			node = prev;
-			lines_cleared++;
-		} else {
-			// Keep going
-			node = get_offset_node(node, next, 1, &next);
-		}
-		check_upto--;
+// This function starts the game. Returns the score. Statistics about the game 
+// are recorded in stats.
+int begin(Settings settings, Stats *stats, int *final_level) {
+	Renderer renderer;
+	Game game;
+	InputQueue input;
+	InputEvent event;
+	Frame *frame;
+	AutoShift as = create_auto_shift(settings);
+	AutoShift bot_as = as;
+	Bot *bot = NULL;
+	BotMove move;
+	long long now, next_tick, mark, started, level_started;
+	int events, old_level, old_score, dirty = 1, piece_inputs = 0;
+	create_game(&game, settings.seed, settings.rows);
+	game_dig(&game, settings.dig);
+	if (settings.exporter != NULL) {
+		game.on_place = export_placement;
+		game.on_place_data = settings.exporter;
 	}
 
-	// Add base score depending on how many lines were broken
-	switch (lines_cleared) {
-		case 1:
-			base_score = 100;
-			break;
-		case 2:
-			base_score = 300;
-			break;
-		case 3:
-			base_score = 500;
-			break;
-		case 4:
-			base_score = 800;
-			break;
+	create_stats(stats, settings.seed);
+	stats->n_types = N_PIECES;
+
+	// If the bot can't be started, the player plays
+	if (settings.autoplay > 0) {
+		bot = start_bot(settings.placements);
 	}
 
-	return base_score * level;
-}
+	// From here on, only the render thread uses ncurses
+	draw_begin(&renderer.gw);
+	start_input(&input);
+	start_renderer(&renderer, settings.pacing);
 
-// This function places the moving piece into the list. It returns the points 
-// awarded after placing the piece.
-static int place_piece(MovingPiece *mp, List *list, int level) {
-	int score = 0;
+	next_tick = time_ns();
+	if (bot != NULL) {
+		ask_bot(bot, &game, next_tick + settings.autoplay * 1000000LL);
+	}
 
-	if (mp->current == NULL) {
-		while (list_index_from_y(mp->position.y) > list->count - 1) {
-			mp->current = add_node(list);
+	mark = started = level_started = next_tick;
+	while (1) {
+		// Hand the game to the render thread when something changed. If it 
+		// is still copying the buffer, try again next tick.
+		if (dirty && (frame = begin_frame(&renderer)) != NULL) {
+			take_snapshot(&game, frame);
+			publish_frame(&renderer);
+			stats->frames++;
+			dirty = 0;
 		}
 
-		mp->next = NULL;
-	}
-	
-	for (int i = 0; i < mp->structure.n_blocks; i++) {
-		Block block = mp->structure.blocks[i];
-		Node *node = get_offset_node(mp->current, mp->next, block.position.y, 
-			NULL);
-		node->value[mp->position.x + block.position.x] = block.colour;
-	}
+		charge(&stats->render_time, &mark);
 
-	score += check_break_lines(list, mp->current, mp->next, 4, level);
-	return score;
-}
+		if (renderer_paused(&renderer)) {
+			// The window is too small (or the first frame isn't drawn yet). 
+			// Input is useless while the game is paused.
+			while (peek_input(&input, &event)) {
+				pop_input(&input);
+			}
 
-// Advance level if needed.
-const void level_advancer(int score, int *level, float *frames_until_fall) {
-	int cond;
+			sleep_until(time_ns() + PAUSE_POLL_NS);
+			charge(&stats->sleep_time, &mark);
 
-	while (1) {
-		cond = (score > (*level * (*level + 1)) / 2 * 1000);
-		if (*level >= 10) {
-			cond = (score > 10 / 2 * 11 * 1000 + (*level - 10) * 1000);
+			// Don't try to catch up on the time spent paused
+			next_tick = time_ns();
+			continue;
 		}
 
-		if (*level == 15) {
-			cond = 0;
+		sleep_until(next_tick);
+		charge(&stats->sleep_time, &mark);
+		next_tick += TICK_NS;
+		if (time_ns() - next_tick > MAX_CATCHUP_TICKS * TICK_NS) {
+			// Fell too far behind (e.g. suspended), don't fast forward.
+			next_tick = time_ns();
 		}
 
-		if (!cond) {
-			break;
+		events = 0;
+		old_level = game.level;
+		old_score = game.score;
+		now = time_ns();
+
+		if (bot != NULL) {
+			// The bot thinks while the piece falls. Keys are ignored.
+			while (peek_input(&input, &event)) {
+				pop_input(&input);
+			}
+
+			if (take_move(bot, &move)) {
+				events |= play_move(&bot_as, &game, &move, now, 
+					&piece_inputs);
+			}
 		}
 
-		*level = *level + 1;
-		*frames_until_fall = *frames_until_fall - 0.8;
-	}
-}
+		if (!as.releases && key_releases()) {
+			// The terminal answered that it reports releases. A key held 
+			// until now would never be released.
+			as.releases = 1;
+			as.direction = as.held = 0;
+		}
 
-// Resize the game and pause if the window is too small.
-static void wait_for_resize(GameWindows *gw, MovingPiece mp, List list, 
-							 Piece *next_piece, Piece *held_piece) {
-	int can_continue = 0;
-	int ch;
-
-	// Draw error msg
-	del_main_wins(*gw);
-	set_main_wins(gw);
-	draw_small_error(*gw);
-
-	wtimeout(gw->body, -1);	// blocking read
-	while (!can_continue) {
-		ch = wgetch(gw->body); // discard useless input (game is paused)
-		if (ch == KEY_RESIZE) {
-			// Redraw error msg
-			del_main_wins(*gw);
-			set_main_wins(gw);
-			draw_small_error(*gw);
-			can_continue = check_if_fits();
+		// Get input: the keys pressed until this tick, in the order they 
+		// were pressed. Auto shift sees when each key was pressed.
+		while (peek_input(&input, &event) && event.time <= now) {
+			pop_input(&input);
+			piece_inputs += (event.type == INPUT_PRESS);
+			events |= press_key(&as, &game, event.key, event.type, 
+				event.time);
+			if (events & (GAME_PLACED | GAME_HELD)) {
+				break;
+			}
 		}
-	}
-	wtimeout(gw->body, 0); // nonblocking
-}
 
-// This function starts the game. Returns the score.
-int begin(int *final_level) {
-	GameWindows gw;
-	MovingPiece mp, upd;
-	List list = create_list();
-	float frames_until_fall = TICKRATE / 2, frames_drawn = 0.0;
-	int ch, type_of_held_piece = -1, has_held = 0, type_of_next_piece = -1;
-	int score = 0, level = 1;
-	int queued_draw_next = 0, queued_draw_hold = 0, queued_resize = 0;
-	int seed = time(NULL);
-	srand(seed);
-
-	draw_begin(&gw);
-	set_pieces();
-	get_next_piece(&mp, list, type_of_next_piece, &type_of_next_piece);
-
-	if (!check_if_fits()) {
-		// Can't start loop. Wait for a resize
-		wait_for_resize(&gw, mp, list, &PIECES[type_of_next_piece], NULL);
-		// Can draw game. End current main wins and begin new mains.
-		del_main_wins(gw);
-		set_main_wins(&gw);
-	}
+		charge(&stats->input_time, &mark);
 
-	// Set game wins
-	set_game_wins(&gw);
+		if (!(events & GAME_PLACED)) {
+			events |= auto_shift(&as, &game, now);
+			events |= game_tick(&game);
+		}
 
-	// Initial draw
-	draw(gw, mp, list, &PIECES[type_of_next_piece], NULL);
+		if (bot != NULL && (events & GAME_PLACED) && !(events & GAME_OVER)) {
+			// Asked before the next tick, so that a quick answer is played 
+			// before the new piece falls at all
+			ask_bot(bot, &game, now + settings.autoplay * 1000000LL);
+		}
 
-	while (1) {
-		if (queued_resize) {
-			// Received a resize request. Check if it is possible, if not pause 
-			// the game until it is.
-			Piece *held_piece = NULL;
-			if (type_of_held_piece > -1) {
-				held_piece = &PIECES[type_of_held_piece];
+		if (events & GAME_PLACED) {
+			stats->pieces++;
+			stats->pieces_by_type[game.placed_type]++;
+			stats->inputs += piece_inputs;
+			stats->inputs_by_type[game.placed_type] += piece_inputs;
+			piece_inputs = 0;
+			if (game.lines_cleared > 0) {
+				stats->clears[game.lines_cleared - 1]++;
 			}
 
-			if (!check_if_fits()) {
-				del_game_wins(gw);
-
-				wait_for_resize(&gw, mp, list, &PIECES[type_of_next_piece], 
-					held_piece);
-				
-				// Can now size. Reset wins
-				del_main_wins(gw);
-				set_main_wins(&gw);
-				set_game_wins(&gw);
-				draw(gw, mp, list, &PIECES[type_of_next_piece], held_piece);
-			} else {
-				resize_game(&gw, mp, list, &PIECES[type_of_next_piece], 
-					held_piece);
+			if (stack_height(game.list) > stats->max_height) {
+				stats->max_height = stack_height(game.list);
 			}
-
-			queued_resize = 0;
 		}
 
-		if (queued_draw_next) {
-			draw_next_display(gw.next_display, &PIECES[type_of_next_piece]);
-			queued_draw_next = 0;
+		if (game.level != old_level) {
+			stats->level_times[old_level - 1] += now - level_started;
+			level_started = now;
 		}
 
-		if (queued_draw_hold) {
-			draw_hold_display(gw.hold_display, &PIECES[type_of_held_piece]);
-			queued_draw_hold = 0;
-		}
+		// The score, next and hold displays are drawn from the same frame
+		dirty |= events & (GAME_MOVED | GAME_NEXT | GAME_HELD | GAME_PLACED);
+		dirty |= (game.score != old_score);
 
-		draw_board(gw.board, mp, list);
-		upd = mp;
-
-		// Get input
-		while ((ch = wgetch(gw.body)) != -1) {
-			if (ch == KEY_RESIZE) {
-				queued_resize = 1;
-			} else if (ch == ' ') {
-				fall(&mp, list);
-				// force place
-				frames_drawn = frames_until_fall;
-				upd = mp;
-				break;
-			} else if (!has_held && (ch == 'c' || ch == 'C')) {
-				has_held = 1;
-				if (type_of_held_piece == -1) {
-					// No currently held piece, get from next.
-					type_of_held_piece = mp.type;
-					get_next_piece(&mp, list, type_of_next_piece, 
-						&type_of_next_piece);
-					queued_draw_next = 1;
-				} else {
-					int tmp = mp.type;
-					get_specific_piece(&mp, list, type_of_held_piece);
-					type_of_held_piece = tmp;
-				}
-
-				queued_draw_hold = 1;
-				frames_drawn = -1.0;
-				upd = mp;
-				break;
-			}
-			
-			input_updater(&upd, ch, list);
-			advance(&mp, &upd, list);
-			upd = mp;
+		charge(&stats->simulation_time, &mark);
+		trace_poll();
+
+		if (events & GAME_OVER) {
+			break;
 		}
+	}
 
-		// Tick down after a certain amount of passes
-		if (frames_drawn >= frames_until_fall) {
-			move_down(&upd, list);
-			if (advance(&mp, &upd, list) == 0) {
-				// Could not advance piece further: place and regenerate
-				int changes = place_piece(&mp, &list, level);
-				// Allow player to hold pieces again
-				has_held = 0;
-
-				if (changes > 0) {
-					score += changes;
-					level_advancer(score, &level, &frames_until_fall);
-					draw_score_display(gw.score_display, score, level);
-				}
-
-				if (!get_next_piece(&mp, list, type_of_next_piece, 
-					&type_of_next_piece)) {
-					// Lose condition
-					break;
-				} else {
-					queued_draw_next = 1;
-				}
+	now = time_ns();
+	stats->level_times[game.level - 1] += now - level_started;
+	stats->duration = now - started;
 
-			}
-			frames_drawn = -1.0;
-		}
+	// Show the last frame before the render thread stops. It can't be 
+	// skipped: wait until the render thread is done copying the buffer.
+	while ((frame = begin_frame(&renderer)) == NULL);
+	take_snapshot(&game, frame);
+	publish_frame(&renderer);
+	stats->frames++;
 
-		frames_drawn++;
-		sleep_ms((int) (1000 / TICKRATE));
+	if (bot != NULL) {
+		stop_bot(bot);
 	}
 
-	draw_end(gw);
-	free_list(&list);
+	stop_renderer(&renderer);
+	stop_input();
+	stats->frames_drawn = renderer.drawn;
+	draw_end(renderer.gw);
+	free_game(&game);
 
-	*final_level = level;
-	return score;
+	stats->score = game.score;
+	stats->level = game.level;
+	*final_level = game.level;
+	return stats->score;
 }
@@ -1 +1,2 @@
-int begin(int *final_level);
\ No newline at end of file
+void take_snapshot(Game *game, Frame *frame);
+int begin(Settings settings, Stats *stats, int *final_level);
\ No newline at end of file
@@ -4,3 +4,20 @@ typedef struct {
 		WINDOW *title, *body, *preboard, *board, *score_display, *hold_display;
         WINDOW *next_display;
 } GameWindows;
+
+// The render thread. The game writes frames into the buffer it doesn't 
+// publish, and the thread takes the one published last (see render.c). 
+// paused is set while the terminal is too small for the game. With pacing, 
+// frames are at least interval nanoseconds apart, and the terminal is asked 
+// for its cursor position after a frame (at asked_at, unless it is 0) while 
+// asking is set. fastest is the fastest answer so far, -1 if none. drawn 
+// counts the frames drawn.
+typedef struct {
+	GameWindows gw;
+	Frame frames[2];
+	unsigned state;
+	int paused, stopping, pacing, asking, drawn;
+	long long interval, asked_at, fastest;
+	sem_t wake;
+	pthread_t thread;
+} Renderer;
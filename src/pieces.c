@@ -1,86 +1,222 @@
 #include "structs.h"
 
 #include <stdio.h>
+#include <string.h>
 
-#define MAX_FILEPATH 35
+#define MAX_FILEPATH 4096
+#define MIN_PREVIEW_SIZE 4
 
-Piece PIECES[N_PIECES];
-Piece ROTATED_PIECES[N_PIECES][ROTATIONS];
+// The orientations of each piece, without duplicates. PIECES has the first
+// orientation of each piece (the one it spawns in).
+Piece PIECES[MAX_PIECES];
+Piece ORIENTATIONS[MAX_PIECES][MAX_ORIENTATIONS];
+int N_ORIENTATIONS[MAX_PIECES];
+int N_PIECES = 0;
 
-void swap(int *x, int *y) {
-	// bitwise swapping!!
-	*x = *x ^ *y;
-	*y = *x ^ *y;
-	*x = *x ^ *y;
+// The name of each piece, from the comment at the start of its file.
+char PIECE_NAMES[MAX_PIECES][MAX_PIECE_NAME + 1];
+
+// Size of the next and hold displays: fits the widest or tallest piece.
+int PREVIEW_SIZE = MIN_PREVIEW_SIZE;
+
+// This function calculates the collision masks and bounds of a piece from
+// its blocks.
+static void set_masks(Piece *piece) {
+	piece->left = piece->top = MAX_PIECE_SIZE;
+	piece->right = piece->bottom = -1;
+	for (int i = 0; i < MAX_PIECE_SIZE; i++) {
+		piece->masks[i] = 0;
+	}
+
+	for (int i = 0; i < piece->n_blocks; i++) {
+		Point position = piece->blocks[i].position;
+		piece->masks[position.y] |= 1 << position.x;
+
+		if (position.x < piece->left) {
+			piece->left = position.x;
+		}
+		if (position.x > piece->right) {
+			piece->right = position.x;
+		}
+		if (position.y < piece->top) {
+			piece->top = position.y;
+		}
+		if (position.y > piece->bottom) {
+			piece->bottom = position.y;
+		}
+	}
 }
 
-// This function returns a piece with a certain type. It is only used 
-// internally.
-// Each piece structure is saved in a file in the pieces folder. Each file 
-// contains the number of blocks, followed by that many lines containing 
-// the x, y coordinates and the colour of each block.
-static void get_piece(Piece *piece, int type) {
+// This function reads the piece with a certain type from a folder. It is only
+// used internally. Returns 0 if the piece does not exist, -1 if it is invalid.
+// Each piece structure is saved in a file in the folder. Each file contains
+// a comment starting with the name of the piece ("# T piece"), then
+// the number of blocks, followed by that many lines containing the y, x
+// coordinates and the colour of each block. The piece rotates inside the
+// smallest square grid (starting from 0, 0) that fits it.
+static int get_piece(Piece *piece, char *name, const char *folder, int type) {
 	FILE *file;
 	Block block;
 	char filepath[MAX_FILEPATH];
-	
-	sprintf(filepath, "pieces/piece_%d.txt", type);
+	int valid = 1;
+
+	snprintf(filepath, MAX_FILEPATH, "%s/piece_%d.txt", folder, type);
 	file = fopen(filepath, "r");
-	
-	fscanf(file, "%*[^\n]");			// skip first line (a comment)
-	fscanf(file, "%d", &piece->n_blocks);
-	fscanf(file, "%d%d", &piece->center.x, &piece->center.y); // center of grid
-	fscanf(file, "%d", &piece->even);
+	if (file == NULL) {
+		return 0;
+	}
+
+	// At most MAX_PIECE_NAME characters, on the first line
+	if (fscanf(file, "#%*[ \t]%7[^ \t\n]", name) != 1) {
+		snprintf(name, MAX_PIECE_NAME + 1, "%d", type);
+	}
+	fscanf(file, "%*[^\n]");			// skip the rest of the comment
+	if (fscanf(file, "%d", &piece->n_blocks) != 1 || piece->n_blocks < 1 ||
+		piece->n_blocks > MAX_PIECE_BLOCKS) {
+		fclose(file);
+		return -1;
+	}
+
+	piece->size = 0;
 	for (int i = 0; i < piece->n_blocks; i++) {
-		fscanf(file, "%d%d", &block.position.y, &block.position.x);
-		fscanf(file, "%d", &block.colour);
+		if (fscanf(file, "%d%d%d", &block.position.y, &block.position.x,
+			&block.colour) != 3) {
+			valid = 0;
+			break;
+		}
+
+		if (block.position.x < 0 || block.position.x >= MAX_PIECE_SIZE ||
+			block.position.y < 0 || block.position.y >= MAX_PIECE_SIZE) {
+			valid = 0;
+			break;
+		}
+
+		if (block.position.x + 1 > piece->size) {
+			piece->size = block.position.x + 1;
+		}
+		if (block.position.y + 1 > piece->size) {
+			piece->size = block.position.y + 1;
+		}
+
 		piece->blocks[i] = block;
 	}
-	
+
 	fclose(file);
+	set_masks(piece);
+
+	return valid ? 1 : -1;
 }
 
-static void get_rotated_piece(Piece piece, Piece rotated[ROTATIONS]) {
-	// Copy
-	for (int i = 0; i < ROTATIONS; i++) {
-		rotated[i].n_blocks = piece.n_blocks;
-		rotated[i].center = piece.center;
-		rotated[i].even = piece.even;
-		for (int j = 0; j < piece.n_blocks; j++) {
-			rotated[i].blocks[j].position = piece.blocks[j].position;
-			rotated[i].blocks[j].colour = piece.blocks[j].colour;
+// Rotate a piece clockwise inside its grid: (x, y) -> (size - 1 - y, x)
+static void get_rotated_piece(Piece piece, Piece *rotated) {
+	*rotated = piece;
+	for (int i = 0; i < piece.n_blocks; i++) {
+		rotated->blocks[i].position.x = piece.size - 1 -
+			piece.blocks[i].position.y;
+		rotated->blocks[i].position.y = piece.blocks[i].position.x;
+	}
+
+	set_masks(rotated);
+}
+
+// Check whether two orientations have the same shape, wherever they are in
+// their grid.
+static int same_shape(Piece *a, Piece *b) {
+	if (a->bottom - a->top != b->bottom - b->top) {
+		return 0;
+	}
+
+	for (int i = 0; i <= a->bottom - a->top; i++) {
+		if (a->masks[a->top + i] >> a->left != 
+			b->masks[b->top + i] >> b->left) {
+			return 0;
 		}
 	}
 
-	for (int i = 0; i < ROTATIONS; i++) {
-		// Rotate i + 1 times. (x, y) -> (y, -x)
-		for (int j = 0; j < i + 1; j++) {
-			for (int k = 0; k < rotated[i].n_blocks; k++) {
-				// Subtract center before rotating (origin is center)
-				rotated[i].blocks[k].position.x -= 
-					rotated[i].center.x;
-				rotated[i].blocks[k].position.y -=
-					rotated[i].center.y;
-
-				swap(&rotated[i].blocks[k].position.x, 
-					&rotated[i].blocks[k].position.y);
-				rotated[i].blocks[k].position.x *= -1;
-				rotated[i].blocks[k].position.x -= rotated[i].even;
-
-				// Add center back in
-				rotated[i].blocks[k].position.x += 
-					rotated[i].center.x;
-				rotated[i].blocks[k].position.y +=
-					rotated[i].center.y;
+	return 1;
+}
+
+// This function derives the unique orientations of a piece. Rotations that
+// give an orientation seen before (like all of them for O) are dropped.
+static void get_orientations(Piece piece, Piece orientations[MAX_ORIENTATIONS],
+							 int *n_orientations) {
+	Piece rotated = piece;
+	*n_orientations = 0;
+
+	for (int i = 0; i < MAX_ORIENTATIONS; i++) {
+		int duplicate = 0;
+		for (int j = 0; j < *n_orientations; j++) {
+			if (same_shape(&rotated, &orientations[j])) {
+				duplicate = 1;
+				break;
 			}
 		}
+
+		if (!duplicate) {
+			orientations[(*n_orientations)++] = rotated;
+		}
+
+		get_rotated_piece(rotated, &rotated);
+	}
+}
+
+// This function loads all the pieces in a folder (piece_0.txt, piece_1.txt...)
+// Returns the number of pieces, or 0 if the first one is missing or any
+// piece is invalid.
+int set_pieces(const char *folder) {
+	N_PIECES = 0;
+	PREVIEW_SIZE = MIN_PREVIEW_SIZE;
+
+	while (N_PIECES < MAX_PIECES) {
+		Piece *piece = &PIECES[N_PIECES];
+		int found = get_piece(piece, PIECE_NAMES[N_PIECES], folder, 
+			N_PIECES);
+		if (found == -1) {
+			return N_PIECES = 0;
+		}
+
+		if (found == 0) {
+			break;
+		}
+
+		if (piece->right - piece->left + 1 > PREVIEW_SIZE) {
+			PREVIEW_SIZE = piece->right - piece->left + 1;
+		}
+		if (piece->bottom - piece->top + 1 > PREVIEW_SIZE) {
+			PREVIEW_SIZE = piece->bottom - piece->top + 1;
+		}
+
+		get_orientations(*piece, ORIENTATIONS[N_PIECES],
+			&N_ORIENTATIONS[N_PIECES]);
+		N_PIECES++;
 	}
+
+	return N_PIECES;
 }
 
-// This function saves all possible pieces.
-void set_pieces() {
-	for (int i = 0; i < N_PIECES; i++) {
-		get_piece(&PIECES[i], i);
-		get_rotated_piece(PIECES[i], ROTATED_PIECES[i]);
+// This function reads a sequence of piece names, like "IOLJSZT". Names are 
+// matched longest first, so "F'F" is F' then F. Returns the number of pieces, 
+// or -1 if a name is unknown or there are more than max.
+int parse_queue(const char *text, int *queue, int max) {
+	int n = 0;
+
+	while (*text != '\0') {
+		int type = -1, length = 0;
+		for (int i = 0; i < N_PIECES; i++) {
+			int l = strlen(PIECE_NAMES[i]);
+			if (l > length && strncmp(text, PIECE_NAMES[i], l) == 0) {
+				type = i;
+				length = l;
+			}
+		}
+
+		if (type == -1 || n == max) {
+			return -1;
+		}
+
+		queue[n++] = type;
+		text += length;
 	}
+
+	return n;
 }
@@ -1 +1,2 @@
-void set_pieces();
+int set_pieces(const char *folder);
+int parse_queue(const char *text, int *queue, int max);
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "structs.h"
+
+#define MAGIC "TTRSPLC1"
+#define MAX_KEYS (1 << 24)	// surface keys per piece type
+
+// Most pieces are placed flat on the stack: every column of the piece rests
+// on the column under it, and no hole is left. Whether an orientation does
+// depends only on the differences between the heights of the columns it
+// covers, the contour of the surface there. A placement file has, for each
+// piece type and contour, the orientations that rest flat on it, so the bot
+// looks them up instead of dropping every orientation in every column.
+//
+// A contour is the window - 1 height differences from a column to the right
+// (window is the width of the widest orientation), each clamped to
+// [-limit, limit]. limit is one more than any difference an orientation can
+// rest on, so a clamped difference, like the wall past the last column, never
+// matches. The contour is packed in a key, as a number in base 2 * limit + 1.
+//
+// The file is made once for a set of pieces (tetris -w), in native byte
+// order: the header, then for each piece type, n_keys bytes with bit o set
+// if orientation o rests flat on the contour. The pieces are hashed into the
+// header, so a file made for other pieces is refused.
+
+extern Piece ORIENTATIONS[MAX_PIECES][MAX_ORIENTATIONS];
+extern int N_ORIENTATIONS[MAX_PIECES];
+extern int N_PIECES;
+
+// The height of the lowest block of each column of an orientation, from the
+// bottom of the orientation.
+static void get_bottom(const Piece *piece, int bottom[MAX_PIECE_SIZE]) {
+	for (int x = piece->left; x <= piece->right; x++) {
+		int y = piece->bottom;
+		while (y > piece->top && !((piece->masks[y] >> x) & 1)) {
+			y--;
+		}
+		bottom[x - piece->left] = piece->bottom - y;
+	}
+}
+
+static uint64_t hash_pieces() {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for (int type = 0; type < N_PIECES; type++) {
+		hash = (hash ^ N_ORIENTATIONS[type]) * 0x100000001B3ULL;
+		for (int o = 0; o < N_ORIENTATIONS[type]; o++) {
+			for (int y = 0; y < MAX_PIECE_SIZE; y++) {
+				hash = (hash ^ ORIENTATIONS[type][o].masks[y]) *
+					0x100000001B3ULL;
+			}
+		}
+	}
+
+	return hash;
+}
+
+// Fill the header for the pieces loaded. Returns 0 if the table is too large.
+static int get_header(PlacementHeader *header) {
+	int limit = 0, window = 1;
+
+	for (int type = 0; type < N_PIECES; type++) {
+		for (int o = 0; o < N_ORIENTATIONS[type]; o++) {
+			Piece *piece = &ORIENTATIONS[type][o];
+			int bottom[MAX_PIECE_SIZE], width = piece->right - piece->left + 1;
+
+			get_bottom(piece, bottom);
+			for (int i = 0; i + 1 < width; i++) {
+				if (abs(bottom[i + 1] - bottom[i]) > limit) {
+					limit = abs(bottom[i + 1] - bottom[i]);
+				}
+			}
+
+			if (width > window) {
+				window = width;
+			}
+		}
+	}
+
+	memset(header, 0, sizeof(PlacementHeader));
+	memcpy(header->magic, MAGIC, sizeof(header->magic));
+	header->board_w = BOARD_W;
+	header->n_pieces = N_PIECES;
+	header->window = window;
+	header->limit = limit + 1;
+	header->n_keys = 1;
+	for (int i = 0; i + 1 < window; i++) {
+		header->n_keys *= 2 * header->limit + 1;
+		if (header->n_keys > MAX_KEYS) {
+			return 0;
+		}
+	}
+
+	header->pieces_hash = hash_pieces();
+	return 1;
+}
+
+// Check whether an orientation rests flat on a contour.
+static int rests_on(const Piece *piece, const PlacementHeader *header,
+					uint32_t key) {
+	int bottom[MAX_PIECE_SIZE], width = piece->right - piece->left + 1;
+	int base = 2 * header->limit + 1;
+
+	get_bottom(piece, bottom);
+	for (int i = 0; i + 1 < width; i++) {
+		int difference = (int)(key % base) - header->limit;
+		if (difference != bottom[i + 1] - bottom[i]) {
+			return 0;
+		}
+		key /= base;
+	}
+
+	return 1;
+}
+
+// Make the placement file of the pieces loaded. Returns 0 on success, -1 if
+// the file can't be written or the table would be too large.
+int write_placements(const char *path) {
+	PlacementHeader header;
+	uint8_t *masks;
+	int fd, result = 0;
+
+	if (!get_header(&header)) {
+		return -1;
+	}
+
+	masks = calloc(header.n_keys, 1);
+	if (masks == NULL) {
+		return -1;
+	}
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		free(masks);
+		return -1;
+	}
+
+	if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+		result = -1;
+	}
+
+	for (int type = 0; type < N_PIECES && result == 0; type++) {
+		for (uint32_t key = 0; key < header.n_keys; key++) {
+			masks[key] = 0;
+			for (int o = 0; o < N_ORIENTATIONS[type]; o++) {
+				if (rests_on(&ORIENTATIONS[type][o], &header, key)) {
+					masks[key] |= 1 << o;
+				}
+			}
+		}
+
+		if (write(fd, masks, header.n_keys) != header.n_keys) {
+			result = -1;
+		}
+	}
+
+	if (close(fd) != 0) {
+		result = -1;
+	}
+
+	free(masks);
+	return result;
+}
+
+// Map the placement file of the pieces loaded. Returns NULL on error, or if
+// the file was made for other pieces.
+PlacementTable *open_placements(const char *path) {
+	PlacementTable *table = malloc(sizeof(PlacementTable));
+	PlacementHeader expected;
+	struct stat st;
+	void *map;
+	int fd;
+
+	if (table == NULL) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDONLY);
+	map = (fd != -1 && fstat(fd, &st) == 0 &&
+		st.st_size >= sizeof(PlacementHeader)) ?
+		mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	if (fd != -1) {
+		// The mapping stays after the file is closed
+		close(fd);
+	}
+
+	if (map == MAP_FAILED) {
+		free(table);
+		return NULL;
+	}
+
+	table->size = st.st_size;
+	table->header = map;
+	table->masks = (const uint8_t *)(table->header + 1);
+	if (!get_header(&expected) ||
+		memcmp(table->header, &expected, sizeof(expected)) != 0 ||
+		table->size < sizeof(PlacementHeader) +
+		(size_t)expected.n_pieces * expected.n_keys) {
+		munmap(map, table->size);
+		free(table);
+		return NULL;
+	}
+
+	return table;
+}
+
+void close_placements(PlacementTable *table) {
+	munmap((void *)table->header, table->size);
+	free(table);
+}
+
+// Get the contour key of every column of a board, from the height of each
+// column.
+void surface_keys(const PlacementTable *table, const int heights[BOARD_W],
+				  uint32_t keys[BOARD_W]) {
+	int limit = table->header->limit, base = 2 * limit + 1;
+
+	for (int x = 0; x < BOARD_W; x++) {
+		uint32_t key = 0, scale = 1;
+		for (int i = 0; i + 1 < table->header->window; i++) {
+			int difference = limit;	// the wall
+			if (x + i + 1 < BOARD_W) {
+				difference = heights[x + i + 1] - heights[x + i];
+				if (difference > limit) {
+					difference = limit;
+				} else if (difference < -limit) {
+					difference = -limit;
+				}
+			}
+
+			key += (difference + limit) * scale;
+			scale *= base;
+		}
+		keys[x] = key;
+	}
+}
+
+// Get the orientations of a piece type that rest flat on the contour of a
+// key, as a mask (bit o for orientation o). Their first column is the column
+// of the key.
+int resting_orientations(const PlacementTable *table, int type,
+						 uint32_t key) {
+	return table->masks[(size_t)type * table->header->n_keys + key];
+}
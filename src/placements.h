@@ -0,0 +1,7 @@
+int write_placements(const char *path);
+PlacementTable *open_placements(const char *path);
+void close_placements(PlacementTable *table);
+void surface_keys(const PlacementTable *table, const int heights[BOARD_W],
+				  uint32_t keys[BOARD_W]);
+int resting_orientations(const PlacementTable *table, int type,
+						 uint32_t key);
\ No newline at end of file
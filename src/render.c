@@ -1,16 +1,48 @@
 #include <ncurses.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/ioctl.h>
 
 #include "structs.h"
 #include "ncstructs.h"
-#include "lists.h"
+#include "input.h"
+#include "clock.h"
+#include "trace.h"
 
 #define TITLE "Terminal Tetris"
 
 // Colour pairs (2-8 are reserved for piece colours)
 #define TITLE_PAIR 1
 
+// Bits of the state of a renderer
+#define PUBLISHED 1		// index of the frame published last
+#define FRESH 2			// the renderer hasn't taken it yet
+#define READING 4		// the renderer is copying a frame
+#define READ_INDEX 8	// index of that frame
+
+// How often the render thread checks for a resize when no frame comes
+#define RESIZE_POLL_NS (20 * 1000000LL)
+
+// Frame pacing: the time between two frames starts at one tick, and doubles 
+// (up to a second) whenever the terminal is behind. It shrinks by a quarter 
+// after each frame the terminal took right away.
+#define MIN_FRAME_NS (1000000000LL / SIM_RATE)
+#define MAX_FRAME_NS 1000000000LL
+// Bytes still waiting in the tty after a frame, past which it is behind
+#define SLOW_PENDING 512
+// How much longer than usual the terminal may take to answer a query
+#define MAX_QUEUE_NS (50 * 1000000LL)
+// Stop asking if the terminal never answered in this long
+#define NO_ANSWER_NS (10 * 1000000000LL)
+#define CURSOR_QUERY "\033[6n"		// device status report
+
+extern Piece PIECES[MAX_PIECES];
+extern int PREVIEW_SIZE;
+
 // This function draws the title.
 void draw_title(WINDOW *title) {
 	wclear(title);
@@ -58,37 +90,44 @@ void draw_body(WINDOW *body) {
 	wrefresh(body);
 }
 
-void draw_board(WINDOW *board, MovingPiece mp, List list) {
-	wclear(board);
+// Draw the rows of a frame, with the moving piece and its projection.
+void draw_board(WINDOW *board, const Frame *frame) {
+	TRACE_SCOPE(TRACE_DRAW_BOARD);
+	const Piece *piece = &frame->piece;
+	// Not wclear: it would repaint the whole screen, not only what changed
+	werase(board);
 
 	// Rendering the static pieces
 
-	int y = BOARD_H - 1;
-	Node *current = list.start, *prev = NULL;
-	while (current != NULL) {
+	for (int y = 0; y < BOARD_H; y++) {
 		for (int i = 0; i < BOARD_W; i++) {
-			wattron(board, COLOR_PAIR(current->value[i]));
+			int colour = frame->cells[y][i];
+			if (colour == 0) {
+				continue;
+			}
+
+			wattron(board, COLOR_PAIR(colour));
 			mvwaddstr(board, y, 2 * i, "  ");
-			wattroff(board, COLOR_PAIR(current->value[i]));
+			wattroff(board, COLOR_PAIR(colour));
 		}
-		y--;
-		current = get_offset_node(current, prev, 1, &prev);
 	}
 
-	// Rendering the projection
-	for (int i = 0; i < mp.structure.n_blocks; i++) {
-		Block block = mp.structure.blocks[i];
-		int x = 2 * (mp.projection.x + block.position.x);
-		int y = mp.projection.y + block.position.y;
-		mvwaddstr(board, y, x, "xx");	
+	// Rendering the projection (it can be below the screen)
+	for (int i = 0; i < piece->n_blocks; i++) {
+		Block block = piece->blocks[i];
+		int x = 2 * (frame->projection.x + block.position.x);
+		int y = frame->projection.y + block.position.y;
+		if (y < BOARD_H) {
+			mvwaddstr(board, y, x, "xx");
+		}
 	}
 
 	// Rendering the dynamic piece
 
-	for (int i = 0; i < mp.structure.n_blocks; i++) {
-		Block block = mp.structure.blocks[i];
-		int x = 2 * (mp.position.x + block.position.x);
-		int y = mp.position.y + block.position.y;
+	for (int i = 0; i < piece->n_blocks; i++) {
+		Block block = piece->blocks[i];
+		int x = 2 * (frame->position.x + block.position.x);
+		int y = frame->position.y + block.position.y;
 		wattron(board, COLOR_PAIR(block.colour));
 		mvwaddstr(board, y, x, "  ");
 		wattroff(board, COLOR_PAIR(block.colour));
@@ -99,15 +138,15 @@ void draw_board(WINDOW *board, MovingPiece mp, List list) {
 
 // Draw the next display. If piece points to NULL, don't draw anything inside.
 void draw_next_display(WINDOW *next_display, Piece *piece) {
-	wclear(next_display);
+	werase(next_display);
 	box (next_display, 0, 0);
 	mvwprintw(next_display, 0, 1, "Next");
 
 	if (piece != NULL) {
 		for (int i = 0; i < piece->n_blocks; i++) {
 			Block block = piece->blocks[i];
-			int x = 1 + 2 * block.position.x;
-			int y = 1 + block.position.y;
+			int x = 1 + 2 * (block.position.x - piece->left);
+			int y = 1 + block.position.y - piece->top;
 			wattron(next_display, COLOR_PAIR(block.colour));
 			mvwaddstr(next_display, y, x, "  ");
 			wattroff(next_display, COLOR_PAIR(block.colour));
@@ -119,15 +158,15 @@ void draw_next_display(WINDOW *next_display, Piece *piece) {
 
 // Draw the hold display. If piece points to NULL, don't draw anything inside.
 void draw_hold_display(WINDOW *hold_display, Piece *piece) {
-	wclear(hold_display);
+	werase(hold_display);
 	box (hold_display, 0, 0);
 	mvwaddstr(hold_display, 0, 1, "Held");
 
 	if (piece != NULL) {
 		for (int i = 0; i < piece->n_blocks; i++) {
 			Block block = piece->blocks[i];
-			int x = 1 + 2 * block.position.x;
-			int y = 1 + block.position.y;
+			int x = 1 + 2 * (block.position.x - piece->left);
+			int y = 1 + block.position.y - piece->top;
 			wattron(hold_display, COLOR_PAIR(block.colour));
 			mvwaddstr(hold_display, y, x, "  ");
 			wattroff(hold_display, COLOR_PAIR(block.colour));
@@ -144,23 +183,27 @@ void draw_score_display(WINDOW *score_display, int score, int level) {
 	sprintf(score_msg, "Score: %d", score);
 	sprintf(level_msg, "Level: %d", level);
 
-	wclear(score_display);
+	werase(score_display);
 	mvwaddstr(score_display, 0, 0, score_msg);
 	mvwaddstr(score_display, 1, 0, level_msg);
 	wrefresh(score_display);
 }
 
-void draw(GameWindows gw, MovingPiece mp, List list, Piece *next_piece, 
-		  Piece *held_piece) {
+// The piece of a type, or NULL for none (-1).
+static Piece *piece_or_null(int type) {
+	return (type == -1) ? NULL : &PIECES[type];
+}
+
+void draw(GameWindows gw, const Frame *frame) {
 	draw_title(gw.title);
 	draw_body(gw.body);
 	wclear(gw.preboard);
 	box(gw.preboard, 0, 0);
 	wrefresh(gw.preboard);
-	draw_board(gw.board, mp, list);
-	draw_score_display(gw.score_display, 0, 1);
-	draw_next_display(gw.next_display, next_piece);
-	draw_hold_display(gw.hold_display, held_piece);
+	draw_board(gw.board, frame);
+	draw_score_display(gw.score_display, frame->score, frame->level);
+	draw_next_display(gw.next_display, piece_or_null(frame->next_type));
+	draw_hold_display(gw.hold_display, piece_or_null(frame->held_type));
 }
 	
 void init_pairs() {
@@ -207,32 +250,349 @@ void set_game_wins(GameWindows *gw) {
 	// For some reason you can't create a subwin within a subwin
 	gw->board = subwin(gw->body, BOARD_H, 2 * BOARD_W, 3, 3); 
 	gw->score_display = subwin(gw->body, 2, COLS, BOARD_H + 5, 0);
-	gw->next_display = subwin(gw->body, 6, 10, 2, 2 * BOARD_W + 2 + 2 + 2);
-	gw->hold_display = subwin(gw->body, 6, 10, 10, 2 * BOARD_W + 2 + 2 + 2);
+	gw->next_display = subwin(gw->body, PREVIEW_SIZE + 2, 
+		2 * PREVIEW_SIZE + 2, 2, 2 * BOARD_W + 2 + 2 + 2);
+	gw->hold_display = subwin(gw->body, PREVIEW_SIZE + 2, 
+		2 * PREVIEW_SIZE + 2, PREVIEW_SIZE + 6, 2 * BOARD_W + 2 + 2 + 2);
 	refresh();
 }
 
-void resize_game(GameWindows *gw, MovingPiece mp, List list, 
-				Piece *next_piece, Piece *held_piece) {
+// Draw a frame over the one on screen: the board, and the displays that 
+// changed.
+void draw_changes(GameWindows gw, const Frame *frame, const Frame *shown) {
+	draw_board(gw.board, frame);
+	if (frame->next_type != shown->next_type) {
+		draw_next_display(gw.next_display, piece_or_null(frame->next_type));
+	}
+	if (frame->held_type != shown->held_type) {
+		draw_hold_display(gw.hold_display, piece_or_null(frame->held_type));
+	}
+	if (frame->score != shown->score || frame->level != shown->level) {
+		draw_score_display(gw.score_display, frame->score, frame->level);
+	}
+}
+
+void resize_game(GameWindows *gw, const Frame *frame) {
 	// Complete redraw
 	del_game_wins(*gw);
 	del_main_wins(*gw);
 	set_main_wins(gw);
 	set_game_wins(gw);
-	draw(*gw, mp, list, next_piece, held_piece);	
+	draw(*gw, frame);	
 }
 
-void draw_begin(GameWindows *gw) {
-	initscr();
+// Set up the current screen for the game, whether it was made by initscr or 
+// newterm.
+void setup_screen(GameWindows *gw) {
 	init_pairs();
 	curs_set(0);
 	noecho();
+	cbreak();		// keys are read by the input thread as they come
+	typeahead(-1);	// and must not interrupt drawing
 
 	set_main_wins(gw);
 }
 
+void draw_begin(GameWindows *gw) {
+	initscr();
+	setup_screen(gw);
+}
+
 void draw_end(GameWindows gw) {
 	del_game_wins(gw);
 	del_main_wins(gw);
 	endwin();
 }
+
+// Frames go from the game to the render thread through two buffers, without 
+// locks: the game never waits for the terminal. The state word has the index 
+// of the frame published last, whether it is fresh, and which frame the 
+// render thread is copying, if any. The game writes into the other buffer, 
+// unless the render thread is still copying it: that frame is skipped, and 
+// the next one will be published instead. The render thread only takes the 
+// newest frame, so it drops the frames it had no time to draw.
+
+// Get the buffer to write the next frame into, or NULL if the frame must be 
+// skipped.
+Frame *begin_frame(Renderer *renderer) {
+	unsigned state = __atomic_load_n(&renderer->state, __ATOMIC_ACQUIRE);
+	int index = !(state & PUBLISHED);
+
+	if ((state & READING) && !!(state & READ_INDEX) == index) {
+		return NULL;
+	}
+
+	return &renderer->frames[index];
+}
+
+// Publish the frame written into the buffer from begin_frame.
+void publish_frame(Renderer *renderer) {
+	unsigned state = __atomic_load_n(&renderer->state, __ATOMIC_RELAXED);
+	unsigned published;
+
+	do {
+		published = (state & (READING | READ_INDEX)) | 
+			!(state & PUBLISHED) | FRESH;
+	} while (!__atomic_compare_exchange_n(&renderer->state, &state, 
+		published, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	sem_post(&renderer->wake);
+}
+
+// Copy the newest frame, if there is one that wasn't taken yet.
+static int take_frame(Renderer *renderer, Frame *frame) {
+	unsigned state = __atomic_load_n(&renderer->state, __ATOMIC_RELAXED);
+	unsigned reading;
+
+	do {
+		if (!(state & FRESH)) {
+			return 0;
+		}
+
+		reading = (state & PUBLISHED) | READING | 
+			((state & PUBLISHED) ? READ_INDEX : 0);
+	} while (!__atomic_compare_exchange_n(&renderer->state, &state, reading,
+		1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	*frame = renderer->frames[reading & PUBLISHED];
+	__atomic_and_fetch(&renderer->state, ~(READING | READ_INDEX), 
+		__ATOMIC_RELEASE);
+	return 1;
+}
+
+// Check whether the game is paused because the terminal is too small.
+int renderer_paused(Renderer *renderer) {
+	return __atomic_load_n(&renderer->paused, __ATOMIC_ACQUIRE);
+}
+
+static int stopping(Renderer *renderer) {
+	return __atomic_load_n(&renderer->stopping, __ATOMIC_ACQUIRE);
+}
+
+// Give ncurses the new size of the terminal. Its own SIGWINCH handler is 
+// replaced by the input thread's.
+static void update_terminal_size() {
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) {
+		resizeterm(ws.ws_row, ws.ws_col);
+	}
+}
+
+// Wait until a frame is published, or a while without one.
+static void wait_for_frame(Renderer *renderer) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += RESIZE_POLL_NS;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	sem_timedwait(&renderer->wake, &ts);
+}
+
+// Pause the game until the window is large enough for it (or the game ends).
+static void wait_for_resize(Renderer *renderer) {
+	GameWindows *gw = &renderer->gw;
+
+	__atomic_store_n(&renderer->paused, 1, __ATOMIC_RELEASE);
+
+	// Draw error msg
+	del_main_wins(*gw);
+	set_main_wins(gw);
+	draw_small_error(*gw);
+
+	while (!check_if_fits() && !stopping(renderer)) {
+		wait_for_frame(renderer);
+		if (take_resize()) {
+			// Redraw error msg
+			update_terminal_size();
+			del_main_wins(*gw);
+			set_main_wins(gw);
+			draw_small_error(*gw);
+		}
+	}
+
+	del_main_wins(*gw);
+	set_main_wins(gw);
+	set_game_wins(gw);
+	__atomic_store_n(&renderer->paused, 0, __ATOMIC_RELEASE);
+}
+
+// Check whether the terminal is behind on the output. After a frame, the 
+// terminal is asked where its cursor is: it answers once it went through 
+// everything written before, so the answer takes the latency of the link, 
+// plus the time to drain what is queued on the way. The terminal is behind 
+// if the answer took (or is taking) MAX_QUEUE_NS longer than the fastest one.
+static int lagging(Renderer *renderer, long long now) {
+	long long answered = last_report(), waited;
+
+	if (renderer->asked_at == 0) {
+		return 0;
+	}
+
+	if (answered >= renderer->asked_at) {
+		waited = answered - renderer->asked_at;
+		if (renderer->fastest == -1 || waited < renderer->fastest) {
+			renderer->fastest = waited;
+		}
+
+		renderer->asked_at = 0;
+		return waited > renderer->fastest + MAX_QUEUE_NS;
+	}
+
+	if (renderer->fastest == -1 && now - renderer->asked_at > NO_ANSWER_NS) {
+		// The terminal doesn't answer: only the tty is watched from now on
+		renderer->asked_at = 0;
+		renderer->asking = 0;
+		return 0;
+	}
+
+	return now - renderer->asked_at > renderer->fastest + MAX_QUEUE_NS;
+}
+
+// Adapt the time between frames to how fast the terminal takes output: the 
+// terminal is behind if the answer to the last query is late, if bytes of 
+// the last frame are still queued in the tty, or if writing it took longer 
+// than the time between frames (writes block once the tty is full). Then 
+// rest until the next frame is due, and while the terminal is behind, for up 
+// to a second. Frames published meanwhile are merged, as only the newest one 
+// is drawn.
+static void pace(Renderer *renderer, long long drawn_at, long long draw_time) {
+	int pending = 0;
+	long long now, next;
+
+	ioctl(STDOUT_FILENO, TIOCOUTQ, &pending);
+	if (lagging(renderer, time_ns()) || pending > SLOW_PENDING || 
+		draw_time > renderer->interval) {
+		renderer->interval *= 2;
+		if (renderer->interval > MAX_FRAME_NS) {
+			renderer->interval = MAX_FRAME_NS;
+		}
+	} else {
+		renderer->interval -= renderer->interval / 4;
+		if (renderer->interval < MIN_FRAME_NS) {
+			renderer->interval = MIN_FRAME_NS;
+		}
+	}
+
+	if (renderer->asking && renderer->asked_at == 0) {
+		// Before writing: the answer can come back right away
+		renderer->asked_at = time_ns();
+		write(STDOUT_FILENO, CURSOR_QUERY, sizeof(CURSOR_QUERY) - 1);
+	}
+
+	next = drawn_at + renderer->interval;
+	while (!stopping(renderer) && ((now = time_ns()) < next || 
+		((lagging(renderer, now) || pending > SLOW_PENDING) && 
+		now < drawn_at + MAX_FRAME_NS))) {
+		struct timespec ts;
+		long long rest = (now < next) ? next - now : MIN_FRAME_NS;
+		if (rest > RESIZE_POLL_NS) {
+			rest = RESIZE_POLL_NS;
+		}
+
+		ts.tv_sec = rest / 1000000000LL;
+		ts.tv_nsec = rest % 1000000000LL;
+		nanosleep(&ts, NULL);
+		ioctl(STDOUT_FILENO, TIOCOUTQ, &pending);
+	}
+}
+
+// The render thread. It draws the newest frame, but only the parts that 
+// changed since the frame it drew before, unless the terminal was resized.
+static void *render(void *data) {
+	Renderer *renderer = data;
+	GameWindows *gw = &renderer->gw;
+	Frame frame, shown;
+	long long drawn_at;
+	int resized = 0;
+
+	// Wait for the first frame, and for a terminal that fits it
+	while (!take_frame(renderer, &shown)) {
+		wait_for_frame(renderer);
+	}
+
+	if (!check_if_fits()) {
+		wait_for_resize(renderer);
+	} else {
+		set_game_wins(gw);
+	}
+	draw(*gw, &shown);
+	renderer->drawn = 1;
+	__atomic_store_n(&renderer->paused, 0, __ATOMIC_RELEASE);
+
+	while (!stopping(renderer)) {
+		wait_for_frame(renderer);
+
+		if (take_resize()) {
+			update_terminal_size();
+			resized = 1;
+		}
+
+		if (take_frame(renderer, &frame)) {
+			drawn_at = time_ns();
+			if (!resized) {
+				draw_changes(*gw, &frame, &shown);
+			}
+			shown = frame;
+			renderer->drawn++;
+
+			if (renderer->pacing && !resized) {
+				pace(renderer, drawn_at, time_ns() - drawn_at);
+			}
+		}
+
+		if (resized) {
+			// Complete redraw, pausing if the window is too small
+			if (!check_if_fits()) {
+				del_game_wins(*gw);
+				wait_for_resize(renderer);
+				draw(*gw, &shown);
+			} else {
+				resize_game(gw, &shown);
+			}
+			resized = 0;
+		}
+	}
+
+	// A frame published just before stopping is still drawn
+	if (take_frame(renderer, &frame)) {
+		draw_changes(*gw, &frame, &shown);
+		renderer->drawn++;
+	}
+
+	// Let the terminal answer the last query before input stops being read, 
+	// so the answer doesn't end up in the shell
+	while (renderer->asked_at != 0 && last_report() < renderer->asked_at && 
+		time_ns() - renderer->asked_at < MAX_FRAME_NS) {
+		usleep(RESIZE_POLL_NS / 1000);
+	}
+
+	return NULL;
+}
+
+// Start drawing on a new thread. The game stays paused until the first 
+// frame is on screen. If pacing is set, frames are drawn less often while 
+// the terminal can't keep up.
+void start_renderer(Renderer *renderer, int pacing) {
+	renderer->state = 0;
+	renderer->pacing = pacing;
+	renderer->interval = MIN_FRAME_NS;
+	renderer->asking = pacing;
+	renderer->asked_at = 0;
+	renderer->fastest = -1;
+	renderer->drawn = 0;
+	renderer->paused = 1;
+	renderer->stopping = 0;
+	sem_init(&renderer->wake, 0, 0);
+	pthread_create(&renderer->thread, NULL, render, renderer);
+}
+
+// Stop the render thread, once it drew the last frame it was given.
+void stop_renderer(Renderer *renderer) {
+	__atomic_store_n(&renderer->stopping, 1, __ATOMIC_RELEASE);
+	sem_post(&renderer->wake);
+	pthread_join(renderer->thread, NULL);
+	sem_destroy(&renderer->wake);
+}
\ No newline at end of file
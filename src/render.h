@@ -3,14 +3,19 @@ void del_main_wins(GameWindows gw);
 void del_game_wins(GameWindows gw);
 void set_main_wins(GameWindows *gw);
 void set_game_wins(GameWindows *gw);
-void resize_game(GameWindows *gw, MovingPiece mp, List list, 
-				Piece *next_piece, Piece *held_piece);
+void resize_game(GameWindows *gw, const Frame *frame);
+void setup_screen(GameWindows *gw);
 void draw_begin(GameWindows *gw);
 void draw_end(GameWindows gw);
-void draw(GameWindows gw, MovingPiece mp, List list, Piece *next_piece, 
-          Piece *held_piece);
-void draw_board(WINDOW *board, MovingPiece mp, List list);
+void draw(GameWindows gw, const Frame *frame);
+void draw_board(WINDOW *board, const Frame *frame);
+void draw_changes(GameWindows gw, const Frame *frame, const Frame *shown);
 void draw_next_display(WINDOW *next_display, Piece *piece);
 void draw_hold_display(WINDOW *hold_display, Piece *piece);
 void draw_score_display(WINDOW *score_display, int score, int level);
-void draw_small_error(GameWindows gw);
\ No newline at end of file
+void draw_small_error(GameWindows gw);
+Frame *begin_frame(Renderer *renderer);
+void publish_frame(Renderer *renderer);
+int renderer_paused(Renderer *renderer);
+void start_renderer(Renderer *renderer, int pacing);
+void stop_renderer(Renderer *renderer);
\ No newline at end of file
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "structs.h"
+
+#define MAGIC "TTRSCOR1"
+#define CAPACITY (1 << 18)	// games per file (the file is sparse)
+#define LATEST_GAMES 10	// games of the user shown with the top scores
+
+// A score file is shared by every game on a host: it is mapped by each 
+// process, and games are added without a global lock. A game takes the next 
+// slot with an atomic increment of count, fills it, and only then links it 
+// into the chain of its user with a compare and swap, so a reader never sees 
+// a slot that isn't written yet. Records never change once linked.
+//
+// The top scores are the only thing updated in place. They are kept sorted 
+// in the header, so a leaderboard never scans the file, under a POSIX record 
+// lock on just the bytes of the top list: the kernel drops it if a process 
+// dies while holding it. The file starts empty; the first process to open 
+// it writes the header, under flock, and makes it writable by everyone.
+//
+// Every process can write the file, so slots read from it are checked before 
+// they are used, and chains are never walked further than count steps.
+
+// Lock the top list, for reading (F_RDLCK) or writing (F_WRLCK), or unlock it.
+// Returns 0 on success, -1 on error.
+static int lock_top(ScoreFile *file, short type) {
+	struct flock lock;
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = offsetof(ScoreHeader, n_top);
+	lock.l_len = offsetof(ScoreHeader, users) - offsetof(ScoreHeader, n_top);
+
+	while (fcntl(file->fd, F_SETLKW, &lock) == -1) {
+		if (errno != EINTR) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// Write the header of a new file. Returns 0 on success, -1 on error.
+static int init_file(int fd) {
+	ScoreHeader header;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0) {
+		return -1;
+	}
+
+	if (st.st_size != 0) {
+		// Another process got there first
+		return 0;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(header.magic));
+	header.capacity = CAPACITY;
+	header.record_size = sizeof(ScoreRecord);
+	if (ftruncate(fd, sizeof(header) + 
+		(off_t)CAPACITY * sizeof(ScoreRecord)) != 0 || 
+		pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || 
+		fchmod(fd, 0666) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// Open a score file, creating it if needed. Returns NULL on error, or if the 
+// file isn't a score file of this version.
+ScoreFile *open_scores(const char *path) {
+	ScoreFile *file = malloc(sizeof(ScoreFile));
+	struct stat st;
+	void *map;
+	int valid;
+
+	if (file == NULL) {
+		return NULL;
+	}
+
+	file->fd = open(path, O_RDWR | O_CREAT, 0666);
+	if (file->fd == -1) {
+		free(file);
+		return NULL;
+	}
+
+	flock(file->fd, LOCK_EX);
+	valid = (init_file(file->fd) == 0 && fstat(file->fd, &st) == 0 && 
+		st.st_size >= sizeof(ScoreHeader));
+	flock(file->fd, LOCK_UN);
+
+	map = valid ? mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, 
+		file->fd, 0) : MAP_FAILED;
+	if (map == MAP_FAILED) {
+		close(file->fd);
+		free(file);
+		return NULL;
+	}
+
+	file->size = st.st_size;
+	file->capacity = ((ScoreHeader *)map)->capacity;
+	file->header = map;
+	file->records = (ScoreRecord *)(file->header + 1);
+	if (memcmp(file->header->magic, MAGIC, sizeof(file->header->magic)) != 0 
+		|| file->header->record_size != sizeof(ScoreRecord) || 
+		file->size < sizeof(ScoreHeader) + 
+		(size_t)file->capacity * sizeof(ScoreRecord)) {
+		munmap(map, file->size);
+		close(file->fd);
+		free(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+void close_scores(ScoreFile *file) {
+	munmap(file->header, file->size);
+	close(file->fd);
+	free(file);
+}
+
+// Get the record of a slot (plus one), as found in the file. Returns NULL if 
+// it is 0, or not a slot of the file.
+static ScoreRecord *get_record(ScoreFile *file, uint32_t slot) {
+	if (slot == 0 || slot > file->capacity) {
+		return NULL;
+	}
+
+	return &file->records[slot - 1];
+}
+
+// Copy a record out of the file. Its user name may not end in the file.
+static void copy_record(ScoreRecord *copy, const ScoreRecord *record) {
+	*copy = *record;
+	copy->user[MAX_USER_NAME] = '\0';
+}
+
+// The number of entries of the top list, as found in the file.
+static int count_top(ScoreFile *file) {
+	uint32_t n = file->header->n_top;
+	return (n > TOP_SCORES) ? TOP_SCORES : n;
+}
+
+// FNV-1a of a user name, to pick its bucket.
+static uint32_t user_bucket(const char *user) {
+	uint32_t hash = 2166136261u;
+
+	for (; *user != '\0'; user++) {
+		hash = (hash ^ (unsigned char)*user) * 16777619u;
+	}
+
+	return hash & (USER_BUCKETS - 1);
+}
+
+// Get the name of the user running the game.
+static void get_user(char user[MAX_USER_NAME + 1]) {
+	struct passwd *pw = getpwuid(getuid());
+	const char *name = (pw != NULL) ? pw->pw_name : getenv("USER");
+
+	snprintf(user, MAX_USER_NAME + 1, "%s", (name != NULL) ? name : "?");
+}
+
+// Fill a record with the result of a game, played by the current user.
+void create_score(ScoreRecord *record, const Stats *stats) {
+	memset(record, 0, sizeof(ScoreRecord));
+	get_user(record->user);
+	record->started = stats->started;
+	record->seed = stats->seed;
+	record->score = stats->score;
+	record->level = stats->level;
+	record->pieces = stats->pieces;
+	record->duration_ms = stats->duration / 1000000;
+	for (int i = 0; i < MAX_PIECE_SIZE; i++) {
+		record->lines += stats->clears[i] * (i + 1);
+	}
+}
+
+// Add a game to the top scores, if it makes it. Returns its rank (from 1), or 
+// 0 if it doesn't make it.
+static int add_top(ScoreFile *file, uint32_t slot) {
+	ScoreHeader *header = file->header;
+	ScoreRecord *ranked;
+	int score = file->records[slot].score, rank, n;
+
+	if (lock_top(file, F_WRLCK) != 0) {
+		return 0;
+	}
+
+	// Earlier games keep their rank on a tie. A bad slot ranks last.
+	n = rank = count_top(file);
+	while (rank > 0 && ((ranked = get_record(file, header->top[rank - 1])) 
+		== NULL || ranked->score < score)) {
+		rank--;
+	}
+
+	if (rank < TOP_SCORES) {
+		int moved = n - rank - (n == TOP_SCORES);
+		memmove(&header->top[rank + 1], &header->top[rank], 
+			moved * sizeof(header->top[0]));
+		header->top[rank] = slot + 1;
+		header->n_top = (n < TOP_SCORES) ? n + 1 : n;
+	}
+
+	lock_top(file, F_UNLCK);
+	return (rank < TOP_SCORES) ? rank + 1 : 0;
+}
+
+// Save a game. Returns its rank in the top scores (from 1), 0 if it isn't in 
+// them, or -1 if the file is full.
+int add_score(ScoreFile *file, const ScoreRecord *record) {
+	ScoreHeader *header = file->header;
+	uint32_t slot = __atomic_fetch_add(&header->count, 1, __ATOMIC_RELAXED);
+	uint32_t *head = &header->users[user_bucket(record->user)];
+	uint32_t next;
+
+	if (slot >= file->capacity) {
+		return -1;
+	}
+
+	file->records[slot] = *record;
+
+	// Publish it: readers reach it only through the chain and the top list
+	next = __atomic_load_n(head, __ATOMIC_RELAXED);
+	do {
+		file->records[slot].next = next;
+	} while (!__atomic_compare_exchange_n(head, &next, slot + 1, 1, 
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return add_top(file, slot);
+}
+
+// Copy the top scores, best first. Returns how many there are.
+int top_scores(ScoreFile *file, ScoreRecord records[TOP_SCORES]) {
+	ScoreHeader *header = file->header;
+	int n = 0;
+
+	if (lock_top(file, F_RDLCK) != 0) {
+		return 0;
+	}
+
+	for (int i = 0; i < count_top(file); i++) {
+		ScoreRecord *record = get_record(file, header->top[i]);
+		if (record != NULL) {
+			copy_record(&records[n++], record);
+		}
+	}
+	lock_top(file, F_UNLCK);
+
+	return n;
+}
+
+// Copy up to max of the latest games of a user, newest first. Only the chain 
+// of its bucket is walked, at most count steps, so a loop in it ends. Returns 
+// how many were found.
+int user_scores(ScoreFile *file, const char *user, ScoreRecord *records, 
+				int max) {
+	uint32_t next = __atomic_load_n(&file->header->users[user_bucket(user)], 
+		__ATOMIC_ACQUIRE);
+	uint32_t steps = __atomic_load_n(&file->header->count, __ATOMIC_RELAXED);
+	ScoreRecord *record;
+	int n = 0;
+
+	if (steps > file->capacity) {
+		steps = file->capacity;
+	}
+
+	for (; steps > 0 && n < max && (record = get_record(file, next)) != NULL; 
+		steps--) {
+		if (strncmp(record->user, user, sizeof(record->user)) == 0) {
+			copy_record(&records[n++], record);
+		}
+		next = record->next;
+	}
+
+	return n;
+}
+
+static void print_score(int rank, const ScoreRecord *record) {
+	char date[32];
+	time_t started = record->started;
+	struct tm *tm = localtime(&started);
+
+	if (tm == NULL || 
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M", tm) == 0) {
+		snprintf(date, sizeof(date), "?");
+	}
+
+	printf("%3d. %-16s %8d  level %2d  %4d lines  %s\n", rank, record->user, 
+		record->score, record->level, record->lines, date);
+}
+
+// Print the top scores, then the latest games of the current user.
+void print_scores(ScoreFile *file) {
+	ScoreRecord records[TOP_SCORES > LATEST_GAMES ? TOP_SCORES : LATEST_GAMES];
+	char user[MAX_USER_NAME + 1];
+	int n = top_scores(file, records);
+
+	printf("top scores:\n");
+	for (int i = 0; i < n; i++) {
+		print_score(i + 1, &records[i]);
+	}
+
+	get_user(user);
+	n = user_scores(file, user, records, LATEST_GAMES);
+	printf("latest games of %s:\n", user);
+	for (int i = 0; i < n; i++) {
+		print_score(i + 1, &records[i]);
+	}
+}
@@ -0,0 +1,8 @@
+ScoreFile *open_scores(const char *path);
+void close_scores(ScoreFile *file);
+void create_score(ScoreRecord *record, const Stats *stats);
+int add_score(ScoreFile *file, const ScoreRecord *record);
+int top_scores(ScoreFile *file, ScoreRecord records[TOP_SCORES]);
+int user_scores(ScoreFile *file, const char *user, ScoreRecord *records, 
+				int max);
+void print_scores(ScoreFile *file);
\ No newline at end of file
@@ -0,0 +1,576 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "structs.h"
+#include "engine.h"
+#include "table.h"
+#include "clock.h"
+
+// The solver keeps the bottom SOLVER_MAX_HEIGHT rows of the board packed in
+// 64 bits: bit row * BOARD_W + x is set if there is a block on column x, row
+// row from the bottom. Pieces are hard dropped from above the stack, like the
+// game would drop them from where they spawn, so no solution needs a tuck or
+// a spin. Full rows are cleared and the rows above fall, as check_break_lines
+// does. Each solution is then played in a real game to make sure of that.
+//
+// Proving that a queue has no solution means searching every state, which 
+// can take seconds, so the search gives up after TIME_LIMIT_NS.
+
+#define MEMO_BITS 18	// states remembered per thread
+#define MAX_THREADS 64
+#define MAX_TASKS (2 * MAX_ORIENTATIONS * BOARD_W)
+#define TIME_LIMIT_NS (500 * 1000000LL)
+#define CLOCK_STATES 1024	// states searched between looks at the clock
+
+_Static_assert(SOLVER_MAX_HEIGHT * BOARD_W <= 64,
+	"the rows searched must fit in 64 bits");
+
+extern Piece ORIENTATIONS[MAX_PIECES][MAX_ORIENTATIONS];
+extern int N_ORIENTATIONS[MAX_PIECES];
+extern int N_PIECES;
+extern char PIECE_NAMES[MAX_PIECES][MAX_PIECE_NAME + 1];
+
+// An orientation packed like a board, with its bottom left block at bit 0.
+// left is its first column in the grid of the piece.
+typedef struct {
+	uint64_t cells;
+	int width, height, left;
+} Shape;
+
+// A state after the first move. The threads take these in order.
+typedef struct {
+	uint64_t cells;
+	int index, held, height;
+	SolverMove move;
+} Task;
+
+typedef struct {
+	Shape shapes[MAX_PIECES][MAX_ORIENTATIONS];
+	const int *queue;
+	int n_queue, hold, perfect_clear, max_blocks, uniform;
+	uint64_t goal;
+	long long deadline;
+	int gave_up;
+	Task tasks[MAX_TASKS];
+	int n_tasks, next_task;
+	// The first task solved, and its moves
+	int best, n_moves;
+	SolverMove moves[MAX_QUEUE];
+	pthread_mutex_t lock;
+} Problem;
+
+// The search of one thread. If collect is set, the first moves are saved as
+// tasks instead of being searched.
+typedef struct {
+	Problem *problem;
+	TransTable *memo;
+	SolverMove moves[MAX_QUEUE];
+	int task, n_moves, collect, states;
+} Search;
+
+static int search(Search *s, uint64_t cells, int index, int held, int height,
+				  int depth);
+
+// Number of rows up to the highest block.
+static int stack_top(uint64_t cells) {
+	int top = 0;
+	while (top < SOLVER_MAX_HEIGHT && (cells >> (top * BOARD_W)) != 0) {
+		top++;
+	}
+
+	return top;
+}
+
+// Clear the full rows between two rows, making the rows above them fall.
+static uint64_t clear_lines(uint64_t cells, int from, int to, int *cleared) {
+	for (int row = to - 1; row >= from; row--) {
+		uint64_t mask = (uint64_t)FULL_ROW << (row * BOARD_W);
+		if ((cells & mask) == mask) {
+			cells = (cells & ((1ULL << (row * BOARD_W)) - 1)) |
+				((cells >> ((row + 1) * BOARD_W)) << (row * BOARD_W));
+			(*cleared)++;
+		}
+	}
+
+	return cells;
+}
+
+// Check that the empty cells on each side of every full column can be
+// filled with pieces of a certain number of blocks. A full column stays full
+// when lines are cleared, so no piece ever crosses it.
+static int can_split(uint64_t cells, int height, int blocks) {
+	uint64_t walls = FULL_ROW, rows = 0;
+	int start = 0;
+
+	for (int row = 0; row < height; row++) {
+		walls &= cells >> (row * BOARD_W);
+		rows |= 1ULL << (row * BOARD_W);
+	}
+
+	walls = (walls & FULL_ROW) | 1ULL << BOARD_W;
+	while (walls != 0) {
+		int wall = __builtin_ctzll(walls);
+		uint64_t side = ((1ULL << wall) - (1ULL << start)) * rows;
+		if (__builtin_popcountll(~cells & side) % blocks != 0) {
+			return 0;
+		}
+
+		start = wall + 1;
+		walls &= walls - 1;
+	}
+
+	return 1;
+}
+
+// Pack the rest of a state, to look it up in the memo along with the board. 
+// The board is exact, so there are no false hits.
+static uint32_t pack_state(int index, int held, int height) {
+	return index | (held + 1) << 8 | height << 16 | 1 << 24;
+}
+
+// Try every placement of a piece type. Returns 1 if one of them leads to a
+// solution.
+static int try_piece(Search *s, uint64_t cells, int type, int index,
+					 int held, int height, int depth) {
+	Problem *p = s->problem;
+	int top = stack_top(cells);
+
+	for (int o = 0; o < N_ORIENTATIONS[type]; o++) {
+		Shape *shape = &p->shapes[type][o];
+		for (int x = 0; x + shape->width <= BOARD_W; x++) {
+			int row = top, cleared = 0;
+			uint64_t placed;
+			SolverMove move = {type, o, x - shape->left};
+
+			while (row > 0 &&
+				!((shape->cells << ((row - 1) * BOARD_W + x)) & cells)) {
+				row--;
+			}
+
+			if (row + shape->height > height) {
+				continue;
+			}
+
+			placed = clear_lines(cells | shape->cells << (row * BOARD_W + x),
+				row, row + shape->height, &cleared);
+
+			if (s->collect) {
+				Task task = {placed, index, held, height - cleared, move};
+				p->tasks[p->n_tasks++] = task;
+				continue;
+			}
+
+			s->moves[depth] = move;
+			if (search(s, placed, index, held, height - cleared, depth + 1)) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// Depth first search from a state: the board, the next piece of the queue
+// to play, the held piece (-1 if none) and the rows left to fill. The states
+// that fail are remembered in a transposition table, as different orders of 
+// the same pieces often lead to them again.
+static int search(Search *s, uint64_t cells, int index, int held, int height,
+				  int depth) {
+	Problem *p = s->problem;
+	const int *queue = p->queue;
+	int left = p->n_queue - index + (held != -1), empty, failed;
+	uint32_t state;
+
+	if (depth > 0 && cells == p->goal) {
+		s->n_moves = depth;
+		return 1;
+	}
+
+	if (++s->states % CLOCK_STATES == 0 && time_ns() > p->deadline) {
+		__atomic_store_n(&p->gave_up, 1, __ATOMIC_RELAXED);
+	}
+
+	// Give up if there are no pieces left, if another thread already found a
+	// solution that comes first, or if it is too late.
+	if (left == 0 || __atomic_load_n(&p->best, __ATOMIC_RELAXED) < s->task ||
+		__atomic_load_n(&p->gave_up, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+
+	if (p->perfect_clear) {
+		empty = height * BOARD_W - __builtin_popcountll(cells);
+	} else if ((cells & ~p->goal) == 0) {
+		empty = __builtin_popcountll(p->goal) - __builtin_popcountll(cells);
+	} else {
+		return 0;
+	}
+
+	// The pieces left must be able to fill the empty cells exactly
+	if (empty > left * p->max_blocks || (p->uniform && 
+		(empty % p->max_blocks != 0 || (p->perfect_clear && 
+		!can_split(cells, height, p->max_blocks))))) {
+		return 0;
+	}
+
+	// Holding nothing with piece i to play is the same as holding piece i
+	// with piece i + 1 to play (the hold takes the next piece), so only the
+	// latter is searched.
+	if (p->hold && held == -1 && index < p->n_queue) {
+		held = queue[index++];
+	}
+
+	state = pack_state(index, held, height);
+	if (!s->collect && table_get(s->memo, cells, state, &failed)) {
+		return 0;
+	}
+
+	// Play the current piece, or the held one instead
+	if (index < p->n_queue) {
+		if (try_piece(s, cells, queue[index], index + 1, held, height,
+			depth)) {
+			return 1;
+		}
+
+		if (held != -1 && held != queue[index] && try_piece(s, cells, held,
+			index + 1, queue[index], height, depth)) {
+			return 1;
+		}
+	} else if (try_piece(s, cells, held, index, -1, height, depth)) {
+		return 1;
+	}
+
+	// A search cut short proves nothing
+	if (!s->collect &&
+		__atomic_load_n(&p->best, __ATOMIC_RELAXED) > s->task &&
+		!__atomic_load_n(&p->gave_up, __ATOMIC_RELAXED)) {
+		table_put(s->memo, cells, state, 1);
+	}
+
+	return 0;
+}
+
+// Search the tasks in order, until they run out or one that comes before
+// the next one is solved.
+static void *search_tasks(void *data) {
+	Search *s = data;
+	Problem *p = s->problem;
+
+	while (1) {
+		int task = __atomic_fetch_add(&p->next_task, 1, __ATOMIC_RELAXED);
+		if (task >= p->n_tasks ||
+			task > __atomic_load_n(&p->best, __ATOMIC_RELAXED) ||
+			__atomic_load_n(&p->gave_up, __ATOMIC_RELAXED)) {
+			break;
+		}
+
+		Task *t = &p->tasks[task];
+		s->task = task;
+		s->moves[0] = t->move;
+		if (!search(s, t->cells, t->index, t->held, t->height, 1)) {
+			continue;
+		}
+
+		pthread_mutex_lock(&p->lock);
+		if (task < p->best) {
+			__atomic_store_n(&p->best, task, __ATOMIC_RELAXED);
+			memcpy(p->moves, s->moves, sizeof(SolverMove) * s->n_moves);
+			p->n_moves = s->n_moves;
+		}
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	return NULL;
+}
+
+// Search a board with a certain number of rows to fill, spreading the first
+// moves across threads. Returns the number of moves found (0 if none).
+static int search_height(Problem *p, Search *searches, int n_threads,
+						 uint64_t cells, int height) {
+	pthread_t threads[MAX_THREADS];
+	Search collector = {p, NULL};
+
+	p->n_tasks = p->next_task = 0;
+	p->best = MAX_TASKS;
+	collector.collect = 1;
+	search(&collector, cells, 0, -1, height, 0);
+
+	for (int i = 1; i < n_threads; i++) {
+		pthread_create(&threads[i], NULL, search_tasks, &searches[i]);
+	}
+
+	search_tasks(&searches[0]);
+	for (int i = 1; i < n_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	return (p->best < MAX_TASKS) ? p->n_moves : 0;
+}
+
+// Pack the bottom rows of a board (row 0 is the top). Returns 0 if there are
+// blocks above them.
+static int pack_board(const uint16_t board[BOARD_H], uint64_t *cells) {
+	*cells = 0;
+	for (int y = 0; y < BOARD_H; y++) {
+		int row = BOARD_H - 1 - y;
+		if (row >= SOLVER_MAX_HEIGHT && board[y] != 0) {
+			return 0;
+		}
+		if (row < SOLVER_MAX_HEIGHT) {
+			*cells |= (uint64_t)board[y] << (row * BOARD_W);
+		}
+	}
+
+	return 1;
+}
+
+static void set_shapes(Problem *p) {
+	for (int type = 0; type < N_PIECES; type++) {
+		for (int o = 0; o < N_ORIENTATIONS[type]; o++) {
+			Piece *piece = &ORIENTATIONS[type][o];
+			Shape *shape = &p->shapes[type][o];
+			shape->left = piece->left;
+			shape->width = piece->right - piece->left + 1;
+			shape->height = piece->bottom - piece->top + 1;
+			shape->cells = 0;
+			for (int row = 0; row < shape->height; row++) {
+				shape->cells |= (uint64_t)(piece->masks[piece->bottom - row]
+					>> piece->left) << (row * BOARD_W);
+			}
+		}
+	}
+}
+
+// Play the moves of a solution in a game, to check that the game agrees with
+// the solver, and save the board before each move. The hold presses are
+// worked out on the way. Returns 0 if a move can't be played, or if the game
+// doesn't end on the goal (or on an empty board if goal is NULL).
+static int replay(const uint16_t board[BOARD_H], const uint16_t *goal, 
+				  const int *queue, int n_queue, Solution *solution) {
+	uint16_t empty[BOARD_H] = {0};
+	Game game;
+	int index = 0, held = -1, valid = 1;
+
+	create_game(&game, 1, BOARD_H);
+	game_set_board(&game, board);
+	memcpy(solution->boards[0], board, sizeof(solution->boards[0]));
+
+	for (int i = 0; i < solution->n_moves && valid; i++) {
+		SolverMove *move = &solution->moves[i];
+		int current = (index < n_queue) ? queue[index] : -1, steps;
+
+		// Holding with nothing held plays the next piece
+		move->hold = (move->type != current);
+		if (move->hold && held == -1) {
+			held = current;
+			current = (++index < n_queue) ? queue[index] : -1;
+		}
+
+		if (move->type == current) {
+			index++;
+		} else if (move->type == held) {
+			held = current;
+			index++;
+		} else {
+			valid = 0;
+			break;
+		}
+
+		if (!game_spawn(&game, move->type)) {
+			valid = 0;
+			break;
+		}
+
+		for (int j = 0; j < N_ORIENTATIONS[move->type] &&
+			game.mp.rotation != move->rotation; j++) {
+			game_rotate(&game);
+		}
+
+		steps = move->x - game.mp.position.x;
+		game_shift(&game, (steps < 0) ? -1 : 1, abs(steps));
+		valid = (game.mp.rotation == move->rotation &&
+			game.mp.position.x == move->x);
+
+		move->y = game.mp.projection.y;
+		game_hard_drop(&game);
+		get_board(game.list, solution->boards[i + 1]);
+	}
+
+	free_game(&game);
+	return valid && memcmp(solution->boards[solution->n_moves], 
+		(goal != NULL) ? goal : empty, sizeof(empty)) == 0;
+}
+
+// This function finds moves that make a perfect clear from a board (row 0 is
+// the top), or that build the goal shape if goal is not NULL, with the pieces
+// of a queue, in order. If hold is set, the hold piece can be used. The 
+// search is spread across one thread per processor. A perfect clear is 
+// searched with as few rows as possible. Returns 1 if a solution was found, 0 
+// if there is none, or an error: SOLVE_TOO_TALL, SOLVE_NO_MEMORY, 
+// SOLVE_DISAGREED, or SOLVE_GAVE_UP if the search took too long.
+int solve(const uint16_t board[BOARD_H], const uint16_t *goal, 
+		  const int *queue, int n_queue, int hold, Solution *solution) {
+	Problem *p;
+	Search searches[MAX_THREADS];
+	uint64_t cells;
+	int n_threads = sysconf(_SC_NPROCESSORS_ONLN), height, found = 0, gave_up;
+
+	if (n_queue > MAX_QUEUE || !pack_board(board, &cells)) {
+		return SOLVE_TOO_TALL;
+	}
+
+	p = malloc(sizeof(Problem));
+	if (p == NULL) {
+		return SOLVE_NO_MEMORY;
+	}
+
+	p->queue = queue;
+	p->n_queue = n_queue;
+	p->deadline = time_ns() + TIME_LIMIT_NS;
+	p->gave_up = 0;
+	p->hold = hold;
+	p->perfect_clear = (goal == NULL);
+	p->goal = 0;
+	if (goal != NULL && !pack_board(goal, &p->goal)) {
+		free(p);
+		return SOLVE_TOO_TALL;
+	}
+
+	set_shapes(p);
+	p->max_blocks = 0;
+	p->uniform = 1;
+	for (int i = 0; i < n_queue; i++) {
+		int blocks = ORIENTATIONS[queue[i]][0].n_blocks;
+		if (p->max_blocks != 0 && blocks != p->max_blocks) {
+			p->uniform = 0;
+		}
+		if (blocks > p->max_blocks) {
+			p->max_blocks = blocks;
+		}
+	}
+
+	if (n_threads < 1) {
+		n_threads = 1;
+	} else if (n_threads > MAX_THREADS) {
+		n_threads = MAX_THREADS;
+	}
+
+	pthread_mutex_init(&p->lock, NULL);
+	for (int i = 0; i < n_threads; i++) {
+		searches[i].problem = p;
+		searches[i].collect = 0;
+		searches[i].states = 0;
+		searches[i].memo = create_table(MEMO_BITS);
+		if (searches[i].memo == NULL) {
+			n_threads = i;
+			break;
+		}
+	}
+
+	height = stack_top(cells);
+	if (goal != NULL && stack_top(p->goal) > height) {
+		height = stack_top(p->goal);
+	}
+
+	for (; n_threads > 0 && !found && !p->gave_up && 
+		height <= SOLVER_MAX_HEIGHT; height++) {
+		if (height > 0 && search_height(p, searches, n_threads, cells,
+			height)) {
+			found = 1;
+			solution->n_moves = p->n_moves;
+			solution->height = height;
+			memcpy(solution->moves, p->moves, 
+				sizeof(SolverMove) * p->n_moves);
+		}
+
+		if (!p->perfect_clear) {
+			break;
+		}
+	}
+
+	gave_up = p->gave_up;
+	for (int i = 0; i < n_threads; i++) {
+		free_table(searches[i].memo);
+	}
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+
+	if (n_threads == 0) {
+		return SOLVE_NO_MEMORY;
+	}
+
+	if (found && !replay(board, goal, queue, n_queue, solution)) {
+		return SOLVE_DISAGREED;
+	}
+
+	return (!found && gave_up) ? SOLVE_GAVE_UP : found;
+}
+
+// This function reads a board from a file: one line per row, top to bottom, 
+// with '.' or ' ' for an empty cell and anything else for a block. The last 
+// line is the bottom row. Returns 0 on success, -1 on error.
+int read_board(const char *path, uint16_t board[BOARD_H]) {
+	FILE *file = fopen(path, "r");
+	char line[BOARD_W + 2];
+	int rows = 0;
+
+	if (file == NULL) {
+		return -1;
+	}
+
+	memset(board, 0, sizeof(uint16_t) * BOARD_H);
+	while (fgets(line, sizeof(line), file) != NULL) {
+		int length = strcspn(line, "\r\n");
+		if (line[length] == '\0' && !feof(file)) {
+			// Longer than the board
+			rows = BOARD_H + 1;
+			break;
+		}
+
+		if (rows == BOARD_H) {
+			rows++;
+			break;
+		}
+
+		// Shift the rows read so far up
+		memmove(board, board + 1, sizeof(uint16_t) * (BOARD_H - 1));
+		board[BOARD_H - 1] = 0;
+		for (int x = 0; x < length; x++) {
+			if (line[x] != '.' && line[x] != ' ') {
+				board[BOARD_H - 1] |= 1 << x;
+			}
+		}
+		rows++;
+	}
+
+	fclose(file);
+	return (rows <= BOARD_H) ? 0 : -1;
+}
+
+// Print the moves of a solution, each with the board before it and the 
+// piece where it lands.
+void print_solution(const Solution *solution) {
+	for (int i = 0; i < solution->n_moves; i++) {
+		const SolverMove *move = &solution->moves[i];
+		Piece *piece = &ORIENTATIONS[move->type][move->rotation];
+
+		printf("%d. %s%s\n", i + 1, PIECE_NAMES[move->type], 
+			move->hold ? " (hold)" : "");
+
+		for (int y = BOARD_H - solution->height; y < BOARD_H; y++) {
+			for (int x = 0; x < BOARD_W; x++) {
+				int row = y - move->y, column = x - move->x;
+				char c = ((solution->boards[i][y] >> x) & 1) ? '#' : '.';
+				if (row >= 0 && row < MAX_PIECE_SIZE && column >= 0 &&
+					(piece->masks[row] >> column) & 1) {
+					c = PIECE_NAMES[move->type][0];
+				}
+				putchar(c);
+			}
+			putchar('\n');
+		}
+		putchar('\n');
+	}
+}
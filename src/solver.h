@@ -0,0 +1,4 @@
+int solve(const uint16_t board[BOARD_H], const uint16_t *goal, 
+		  const int *queue, int n_queue, int hold, Solution *solution);
+int read_board(const char *path, uint16_t board[BOARD_H]);
+void print_solution(const Solution *solution);
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "structs.h"
+
+// A single game never needs more than this, even at the maximum level.
+#define MAX_LINE 4096
+
+static const char *CLEAR_NAMES[4] = {"single", "double", "triple", "tetris"};
+
+// Clear the statistics for a new game.
+void create_stats(Stats *stats, long long seed) {
+	memset(stats, 0, sizeof(Stats));
+	stats->seed = seed;
+	stats->started = time(NULL);
+}
+
+static double seconds(long long ns) {
+	return ns / 1e9;
+}
+
+// Division that returns 0 instead of dividing by zero.
+static double ratio(double a, double b) {
+	return b == 0 ? 0 : a / b;
+}
+
+// Append formatted text to the line, keeping track of its length. Text that
+// does not fit is dropped (the line is then rejected by append_stats).
+static void put(char *line, int *length, const char *format, ...) {
+	va_list args;
+
+	if (*length >= MAX_LINE) {
+		return;
+	}
+
+	va_start(args, format);
+	*length += vsnprintf(line + *length, MAX_LINE - *length, format, args);
+	va_end(args);
+}
+
+// This function appends the statistics of a game to a JSON Lines file, as
+// one line. The line is formatted in memory and written with a single write()
+// to a file opened for appending, so games that finish at the same time never
+// interleave their lines. Returns 0 on success, -1 on error.
+int append_stats(const char *path, Stats *stats) {
+	char line[MAX_LINE];
+	int length = 0, fd;
+	ssize_t written;
+
+	put(line, &length, "{\"seed\":%lld,\"started\":%lld,\"duration\":%.3f,",
+		stats->seed, stats->started, seconds(stats->duration));
+	put(line, &length, "\"score\":%d,\"level\":%d,\"pieces\":%d,",
+		stats->score, stats->level, stats->pieces);
+	put(line, &length, "\"pps\":%.3f,\"inputs\":%d,\"inputs_per_piece\":%.3f,",
+		ratio(stats->pieces, seconds(stats->duration)), stats->inputs,
+		ratio(stats->inputs, stats->pieces));
+	put(line, &length, "\"max_height\":%d,\"lines\":{", stats->max_height);
+	for (int i = 0; i < 4; i++) {
+		put(line, &length, "%s\"%s\":%d", i ? "," : "", CLEAR_NAMES[i],
+			stats->clears[i]);
+	}
+
+	// Only larger pieces clear more than 4 lines at once
+	for (int i = 4; i < MAX_PIECE_SIZE; i++) {
+		if (stats->clears[i] > 0) {
+			put(line, &length, ",\"%d\":%d", i + 1, stats->clears[i]);
+		}
+	}
+
+	put(line, &length, "},\"level_times\":[");
+	for (int i = 0; i < stats->level; i++) {
+		put(line, &length, "%s%.3f", i ? "," : "",
+			seconds(stats->level_times[i]));
+	}
+
+	put(line, &length, "],\"phases\":{\"input\":%.3f,\"simulation\":%.3f,",
+		seconds(stats->input_time), seconds(stats->simulation_time));
+	put(line, &length, "\"render\":%.3f,\"sleep\":%.3f},",
+		seconds(stats->render_time), seconds(stats->sleep_time));
+	put(line, &length, "\"frames\":%d,\"frames_drawn\":%d,\"piece_types\":[",
+		stats->frames, stats->frames_drawn);
+	for (int i = 0; i < stats->n_types; i++) {
+		put(line, &length, "%s{\"count\":%d,\"inputs_per_piece\":%.3f}",
+			i ? "," : "", stats->pieces_by_type[i],
+			ratio(stats->inputs_by_type[i], stats->pieces_by_type[i]));
+	}
+
+	put(line, &length, "]}\n");
+	if (length >= MAX_LINE) {
+		return -1;
+	}
+
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd == -1) {
+		return -1;
+	}
+
+	written = write(fd, line, length);
+	close(fd);
+
+	return (written == length) ? 0 : -1;
+}
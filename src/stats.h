@@ -0,0 +1,2 @@
+void create_stats(Stats *stats, long long seed);
+int append_stats(const char *path, Stats *stats);
\ No newline at end of file
@@ -1,26 +1,40 @@
-#define N_PIECES 7
-#define MAX_PIECE_BLOCKS 4
-#define ROTATIONS 3
+#include <stdint.h>
+#include <stddef.h>
 
-#define BOARD_W 10
-#define BOARD_H 24
+#define MAX_PIECES 32
+#define MAX_PIECE_BLOCKS 8
+#define MAX_PIECE_SIZE 8	// pieces fit in a MAX_PIECE_SIZE square grid
+#define MAX_ORIENTATIONS 4
+#define MAX_PIECE_NAME 7
+#define MAX_LEVEL 20
+#define SIM_RATE 60	// simulation ticks per second
+
+#define BOARD_W 10	// at most 16 (rows are saved as 16 bit masks)
+#define FULL_ROW ((1 << BOARD_W) - 1)	// the mask of a full row
+#define BOARD_H 24	// rows on screen, and rows of a default board
+#define MAX_BOARD_ROWS 100000
 #define BOARD_H_PAD 1 + 2 + 2  // title bar + inner padding + outer padding
 #define BOARD_W_PAD 2 + 2 // inner padding + outer padding
 #define SCORE_PAD_H 3
-#define HOLD_PAD_W 12
+#define HOLD_PAD_W (2 * PREVIEW_SIZE + 4)	// PREVIEW_SIZE is set by set_pieces
 
 // The value of each node is an array that saves the colour of the block.
 // 0 -> no block
+// The mask of each node has bit i set if there is a block on column i.
 typedef struct node {
 	struct node *link;
 	int *value;
+	uint16_t mask;
 } Node;
 
 // The list needs a last_index in order to efficiently check the collisions 
-// with the moving piece.
+// with the moving piece. rows has every node, by index (0 is the bottom row), 
+// to find a row without walking the list. height is the number of rows of 
+// the board.
 typedef struct {
 	Node *start, *end;
-	int count;
+	Node **rows;
+	int count, capacity, height;
 } List;
 
 typedef struct {
@@ -33,20 +47,259 @@ typedef struct {
 	int colour;
 } Block;
 
-// This structure describes a piece. The position of each block is relative.
+// This structure describes a piece. The position of each block is relative 
+// to the top-left corner of the size x size grid the piece rotates in.
+// masks has a collision mask for each row of the grid (bit x set if there is a 
+// block on column x). left, right, top and bottom bound the blocks.
 typedef struct {
 	Block blocks[MAX_PIECE_BLOCKS];
-	int n_blocks, even;
-	Point center;
+	uint16_t masks[MAX_PIECE_SIZE];
+	int n_blocks, size;
+	int left, right, top, bottom;
 } Piece;
 
 // This structure defines the moving piece.
 // Each moving piece has a line associated with it in a list -> current is 
 // the associated node, next is the next node. (NULL if out of bounds)
-// Rotation: -1 (default); 0-2 -> rotations
+// Rotation: index of the orientation (0 when spawned)
+// pack_piece packs the type, rotation and position in one word.
 typedef struct {
 	Point position, projection;
 	Piece structure;
 	Node *current, *next;
 	int type, rotation;
 } MovingPiece;
+
+// This structure keeps track of how the moving piece falls. Gravity is the 
+// number of rows (usually a fraction of one) the piece falls every tick, and 
+// progress accumulates it. A piece resting on the ground locks after a delay, 
+// which moving or rotating it resets a limited number of times.
+typedef struct {
+	float gravity, progress;
+	int lock_ticks, lock_resets, lowest_y;
+} FallState;
+
+// A piece placement, as passed to the on_place hook of a game. board has the 
+// rows of the board before the piece was placed (row 0 is the top), with bit 
+// x set if there is a block on column x. y is relative to row 0 of board, 
+// and may be past its last row on tall boards. score is the score it earned.
+typedef struct {
+	uint16_t board[BOARD_H];
+	int type, rotation, x, y, next_type, held_type;
+	int lines_cleared, score;
+} Placement;
+
+#define EXPORT_BLOCK 4096	// placements buffered before writing them out
+
+// This structure buffers placements for export_placement. Each field has its 
+// own array (one column of the file), filled up to count. failed is set if 
+// writing a block failed.
+typedef struct {
+	int fd, count, failed;
+	uint16_t board[EXPORT_BLOCK][BOARD_H];
+	int8_t type[EXPORT_BLOCK], rotation[EXPORT_BLOCK];
+	int8_t x[EXPORT_BLOCK];
+	int32_t y[EXPORT_BLOCK];
+	int8_t next_type[EXPORT_BLOCK], held_type[EXPORT_BLOCK];
+	uint8_t lines_cleared[EXPORT_BLOCK];
+	int32_t score[EXPORT_BLOCK];
+} Exporter;
+
+// An entry of a transposition table. hash and state identify a position 
+// (state is 0 in empty entries), and value is what a search saved about it.
+typedef struct {
+	uint64_t hash;
+	uint32_t state;
+	int32_t value;
+} TableEntry;
+
+// A fixed-size table of positions seen by a search (see table.c).
+typedef struct {
+	TableEntry *entries;
+	uint64_t mask;
+} TransTable;
+
+#define SOLVER_MAX_HEIGHT 6	// rows the solver fills (they fit in 64 bits)
+#define MAX_QUEUE 32
+
+// Errors of the solver
+#define SOLVE_TOO_TALL -1	// the board or the goal is above SOLVER_MAX_HEIGHT
+#define SOLVE_NO_MEMORY -2
+#define SOLVE_DISAGREED -3	// the game didn't play the solution as found
+#define SOLVE_GAVE_UP -4	// the search took too long
+
+// A move found by the solver: hard drop a piece of a type, in an orientation 
+// (as in MovingPiece) at column x. It lands at row y. hold is set if the piece 
+// came from hold, or if the current piece was held to play the next one.
+typedef struct {
+	int type, rotation, x, y, hold;
+} SolverMove;
+
+// The moves found by the solver, and the board before each move and after 
+// the last one (row 0 is the top), as the game left it. Only the bottom 
+// height rows of the board are used.
+typedef struct {
+	SolverMove moves[MAX_QUEUE];
+	uint16_t boards[MAX_QUEUE + 1][BOARD_H];
+	int n_moves, height;
+} Solution;
+
+// The start of a placement file (see placements.c), followed by n_keys masks 
+// of orientations for each piece type. The contours of the surface a piece 
+// rests on span window columns, with differences of at most limit - 1. 
+// pieces_hash identifies the pieces it was made for.
+typedef struct {
+	char magic[8];
+	uint32_t board_w, n_pieces, window, limit, n_keys;
+	uint64_t pieces_hash;
+} PlacementHeader;
+
+// A placement file, mapped in memory.
+typedef struct {
+	size_t size;
+	const PlacementHeader *header;
+	const uint8_t *masks;
+} PlacementTable;
+
+// A move chosen by the bot: hold first if hold is set, then hard drop the 
+// piece of a type in an orientation (as in MovingPiece) at column x.
+typedef struct {
+	int hold, type, rotation, x;
+} BotMove;
+
+// The bot that plays on its own thread (see bot.c).
+typedef struct bot Bot;
+
+// Game settings, chosen from the command line. Times are in milliseconds.
+// stats_file is NULL if statistics should not be saved, and exporter is NULL 
+// if placements should not be exported. seed picks the pieces. The board 
+// has rows rows, dig of them filled with garbage. If pacing is set, the 
+// redraw rate follows how fast the terminal takes output. If autoplay is 
+// not 0, the bot plays, with that long to think about each piece. It looks 
+// its moves up in placements first, unless it is NULL.
+typedef struct {
+	int das, arr, rows, dig, pacing, autoplay;
+	uint32_t seed;
+	char *stats_file, *pieces_folder;
+	Exporter *exporter;
+	PlacementTable *placements;
+} Settings;
+
+// What the render thread draws: the colour of each block on screen (0 for 
+// none), the moving piece and its projection (relative to the top row on 
+// screen) and the rest of the game.
+typedef struct {
+	uint8_t cells[BOARD_H][BOARD_W];
+	Piece piece;
+	Point position, projection;
+	int next_type, held_type, score, level;
+} Frame;
+
+#define TOP_SCORES 10	// best games kept in order in a score file
+#define USER_BUCKETS 1024	// must be a power of two
+#define MAX_USER_NAME 31
+
+// A game saved in a score file. next links the games of users in the same 
+// bucket, newest first: it is the slot of the game before it, plus one (0 
+// ends the chain). Times are in seconds since the epoch.
+typedef struct {
+	int64_t started;
+	uint32_t seed, next;
+	int32_t score, level, pieces, lines, duration_ms;
+	char user[MAX_USER_NAME + 1];
+} ScoreRecord;
+
+// The start of a score file, followed by capacity records. count is the 
+// number of slots handed out so far. top has the slots of the TOP_SCORES best 
+// games (plus one), best first, n_top of them used. users has the newest game 
+// of each bucket of users (plus one).
+typedef struct {
+	char magic[8];
+	uint32_t capacity, record_size;
+	uint32_t count, n_top;
+	uint32_t top[TOP_SCORES];
+	uint32_t users[USER_BUCKETS];
+} ScoreHeader;
+
+// A score file, mapped in memory. capacity is the one checked against the 
+// size of the file when it was opened.
+typedef struct {
+	int fd;
+	uint32_t capacity;
+	size_t size;
+	ScoreHeader *header;
+	ScoreRecord *records;
+} ScoreFile;
+
+#define INPUT_QUEUE_SIZE 256	// must be a power of two
+
+#define INPUT_PRESS 1
+#define INPUT_REPEAT 2	// only if the terminal reports releases
+#define INPUT_RELEASE 3
+
+// A key read by the input thread (a character, or an ncurses KEY_ code for 
+// arrows), its type (INPUT_PRESS, INPUT_REPEAT or INPUT_RELEASE) and the time 
+// it was read at, in nanoseconds.
+typedef struct {
+	int key, type;
+	long long time;
+} InputEvent;
+
+// Keys go from the input thread to the game through this ring buffer. head 
+// counts the keys ever pushed and is only written by the input thread, tail 
+// counts the keys taken and is only written by the game.
+typedef struct {
+	InputEvent events[INPUT_QUEUE_SIZE];
+	unsigned head, tail;
+} InputQueue;
+
+// This structure tracks a held left/right key for delayed auto shift. 
+// Direction is -1 (left), 1 (right) or 0. releases is set if the terminal 
+// reports key releases, repeating once repeats of the key arrive. Times are 
+// in nanoseconds: gap is the time between the last key and the one before, 
+// interval the time between the last two repeats.
+typedef struct {
+	int direction, held, releases, repeating;
+	long long das, arr;
+	long long das_start, last_seen, gap, interval, next_shift;
+} AutoShift;
+
+// Statistics recorded during a game. Times are in nanoseconds. clears counts 
+// singles, doubles, triples, tetrises (and more, with larger pieces), and 
+// n_types is the number of piece types. Each tick is split in phases: 
+// reading input, simulating, rendering and sleeping until the next tick. 
+// frames counts the frames given to the render thread, frames_drawn the ones 
+// it drew (the others were merged).
+typedef struct {
+	long long seed, started, duration;
+	long long level_times[MAX_LEVEL];
+	long long input_time, simulation_time, render_time, sleep_time;
+	int score, level, pieces, inputs, max_height, n_types;
+	int frames, frames_drawn;
+	int clears[MAX_PIECE_SIZE];
+	int pieces_by_type[MAX_PIECES], inputs_by_type[MAX_PIECES];
+} Stats;
+
+// This structure holds the state of a game: everything but the input and the 
+// drawing. rng is the state of the piece generator, and hash the Zobrist hash 
+// of the board (see engine.c). placed_type and lines_cleared describe the 
+// last piece placed. If on_place is not NULL, it is called with on_place_data 
+// after every placement.
+typedef struct {
+	List list;
+	MovingPiece mp;
+	FallState falling;
+	int next_type, held_type, has_held;
+	int score, level, placed_type, lines_cleared;
+	uint32_t rng;
+	uint64_t hash;
+	void (*on_place)(void *data, const Placement *placement);
+	void *on_place_data;
+} Game;
+
+// Events returned by the game functions, as flags.
+#define GAME_MOVED 1	// the moving piece changed
+#define GAME_PLACED 2	// a piece was placed
+#define GAME_NEXT 4		// the next piece changed
+#define GAME_HELD 8		// the held piece changed
+#define GAME_OVER 16	// the new piece collided on generation
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+
+#include "structs.h"
+
+// A transposition table remembers what a search found about the positions it
+// went through, so a position reached again by another order of moves isn't
+// searched twice. It has a fixed size, and no chains: a position goes in the
+// slot its hash picks, replacing whatever was there. Forgetting a position
+// only costs time, as long as the search treats a miss as unknown.
+
+// Create a table of 2^bits entries. Returns NULL if it can't be allocated.
+TransTable *create_table(int bits) {
+	TransTable *table = malloc(sizeof(TransTable));
+
+	if (table == NULL) {
+		return NULL;
+	}
+
+	table->mask = (1ULL << bits) - 1;
+	table->entries = calloc(table->mask + 1, sizeof(TableEntry));
+	if (table->entries == NULL) {
+		free(table);
+		return NULL;
+	}
+
+	return table;
+}
+
+void free_table(TransTable *table) {
+	free(table->entries);
+	free(table);
+}
+
+// Find the slot of a position. The hash may come from a packed board rather
+// than a Zobrist hash, so it is mixed with the state again.
+static TableEntry *table_slot(const TransTable *table, uint64_t hash,
+							  uint32_t state) {
+	uint64_t mixed = (hash ^ state * 0x9E3779B97F4A7C15ULL) *
+		0xBF58476D1CE4E5B9ULL;
+	return &table->entries[(mixed ^ (mixed >> 32)) & table->mask];
+}
+
+// Look a position up. state must not be 0. Returns 1 and saves its value if
+// it is in the table, 0 if not.
+int table_get(const TransTable *table, uint64_t hash, uint32_t state,
+			  int *value) {
+	TableEntry *entry = table_slot(table, hash, state);
+
+	if (entry->state != state || entry->hash != hash) {
+		return 0;
+	}
+
+	*value = entry->value;
+	return 1;
+}
+
+// Save a value for a position, replacing the position in its slot, if any.
+void table_put(TransTable *table, uint64_t hash, uint32_t state, int value) {
+	TableEntry *entry = table_slot(table, hash, state);
+
+	entry->hash = hash;
+	entry->state = state;
+	entry->value = value;
+}
@@ -0,0 +1,5 @@
+TransTable *create_table(int bits);
+void free_table(TransTable *table);
+int table_get(const TransTable *table, uint64_t hash, uint32_t state,
+			  int *value);
+void table_put(TransTable *table, uint64_t hash, uint32_t state, int value);
\ No newline at end of file
@@ -0,0 +1,147 @@
+#ifdef TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+
+#include "trace.h"
+
+// Records per thread. Must be a power of two.
+#define TRACE_RECORDS (1 << 16)
+#define TRACE_MASK (TRACE_RECORDS - 1)
+
+static const char *EVENT_NAMES[TRACE_EVENTS] = {
+	"check_collisions", "get_projection", "rotate", "place_piece",
+	"check_break_lines", "draw_board", "decode_input", "take_snapshot",
+	"bot_search", "sleep"
+};
+
+// A fixed-size record of a traced scope. Durations are capped at ~4 seconds.
+typedef struct {
+	int64_t start;
+	uint32_t duration;
+	uint16_t event;
+} TraceRecord;
+
+// Each thread owns one buffer and is the only one writing into it. head
+// counts every record ever written: the newest TRACE_RECORDS are kept.
+typedef struct trace_buffer {
+	TraceRecord records[TRACE_RECORDS];
+	uint64_t head;
+	int tid;
+	struct trace_buffer *next;
+} TraceBuffer;
+
+int trace_enabled = 0;
+
+static const char *trace_path;
+static TraceBuffer *trace_buffers = NULL;	// all buffers, newest first
+static int trace_threads = 0;
+static volatile sig_atomic_t dump_requested = 0;
+static __thread TraceBuffer *local_buffer = NULL;
+
+// Allocate the buffer of the calling thread and add it to the list, without
+// locking: other threads may be registering at the same time.
+static TraceBuffer *register_buffer() {
+	TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+	if (buffer == NULL) {
+		trace_enabled = 0;
+		return NULL;
+	}
+
+	buffer->tid = __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED);
+	buffer->next = __atomic_load_n(&trace_buffers, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&trace_buffers, &buffer->next, buffer,
+		1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return buffer;
+}
+
+void trace_record(int event, long long start, long long end) {
+	TraceRecord *record;
+	long long duration = end - start;
+
+	if (local_buffer == NULL && (local_buffer = register_buffer()) == NULL) {
+		return;
+	}
+
+	record = &local_buffer->records[local_buffer->head & TRACE_MASK];
+	record->start = start;
+	record->duration = (duration > UINT32_MAX) ? UINT32_MAX : duration;
+	record->event = event;
+	// Publish the record to trace_dump
+	__atomic_store_n(&local_buffer->head, local_buffer->head + 1,
+		__ATOMIC_RELEASE);
+}
+
+static void request_dump(int signal) {
+	dump_requested = 1;
+}
+
+// Start tracing. The trace will be written to path.
+void trace_start(const char *path) {
+	trace_path = path;
+	signal(SIGUSR1, request_dump);
+	trace_enabled = 1;
+}
+
+// Dump the trace if it was requested by a signal. Should be called regularly
+// (dumping from the signal handler itself would not be safe).
+void trace_poll() {
+	if (dump_requested) {
+		dump_requested = 0;
+		trace_dump();
+	}
+}
+
+// Write the records of a buffer. The owner thread may still be writing, so
+// the records are copied first, and the ones it overwrote meanwhile dropped.
+static void dump_buffer(FILE *file, TraceBuffer *buffer, int *first) {
+	static TraceRecord copy[TRACE_RECORDS];
+	uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+	uint64_t tail = (head > TRACE_RECORDS) ? head - TRACE_RECORDS : 0;
+	uint64_t new_head;
+
+	for (uint64_t i = tail; i < head; i++) {
+		copy[i & TRACE_MASK] = buffer->records[i & TRACE_MASK];
+	}
+
+	// The slot of new_head may be half written too
+	new_head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+	if (new_head >= TRACE_RECORDS && new_head - TRACE_RECORDS + 1 > tail) {
+		tail = new_head - TRACE_RECORDS + 1;
+	}
+
+	for (uint64_t i = tail; i < head; i++) {
+		TraceRecord record = copy[i & TRACE_MASK];
+		fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+			"\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", *first ? "" : ",",
+			EVENT_NAMES[record.event], buffer->tid, record.start / 1000.0,
+			record.duration / 1000.0);
+		*first = 0;
+	}
+}
+
+// Write every buffer to the trace file, replacing its previous contents.
+void trace_dump() {
+	FILE *file;
+	TraceBuffer *buffer;
+	int first = 1;
+
+	if (!trace_enabled || (file = fopen(trace_path, "w")) == NULL) {
+		return;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	buffer = __atomic_load_n(&trace_buffers, __ATOMIC_ACQUIRE);
+	while (buffer != NULL) {
+		dump_buffer(file, buffer, &first);
+		buffer = buffer->next;
+	}
+
+	fprintf(file, "\n]}\n");
+	fclose(file);
+}
+
+#endif
@@ -0,0 +1,55 @@
+// Trace points, compiled in with make TRACE=1. A traced scope records when it 
+// started and how long it took into a ring buffer owned by the thread. The 
+// buffers are written out in the Chrome trace format (open the file in 
+// ui.perfetto.dev or chrome://tracing) on exit, or when receiving SIGUSR1. 
+// Until trace_start is called, a trace point only costs a branch.
+
+enum {
+	TRACE_CHECK_COLLISIONS,
+	TRACE_GET_PROJECTION,
+	TRACE_ROTATE,
+	TRACE_PLACE_PIECE,
+	TRACE_CHECK_BREAK_LINES,
+	TRACE_DRAW_BOARD,
+	TRACE_DECODE_INPUT,
+	TRACE_TAKE_SNAPSHOT,
+	TRACE_BOT_SEARCH,
+	TRACE_SLEEP,
+	TRACE_EVENTS
+};
+
+#ifdef TRACE
+
+#include "clock.h"
+
+typedef struct {
+	int event;
+	long long start;
+} TraceScope;
+
+extern int trace_enabled;
+
+void trace_record(int event, long long start, long long end);
+void trace_start(const char *path);
+void trace_poll();
+void trace_dump();
+
+static inline void trace_end_scope(TraceScope *scope) {
+	if (scope->start != 0) {
+		trace_record(scope->event, scope->start, time_ns());
+	}
+}
+
+// Trace the rest of the enclosing scope (ends automatically when leaving it).
+#define TRACE_SCOPE(event) \
+	TraceScope trace_scope __attribute__((cleanup(trace_end_scope))) = \
+		{(event), trace_enabled ? time_ns() : 0}
+
+#else
+
+#define TRACE_SCOPE(event)
+#define trace_start(path)
+#define trace_poll()
+#define trace_dump()
+
+#endif
\ No newline at end of file